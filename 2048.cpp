@@ -6,20 +6,21 @@
 #include <string.h>
 #include <time.h>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
 
 #include "2048.h"
-
-#include "config.h"
-#if defined(HAVE_UNORDERED_MAP)
-    #include <unordered_map>
-    typedef std::unordered_map<board_t, trans_table_entry_t> trans_table_t;
-#elif defined(HAVE_TR1_UNORDERED_MAP)
-    #include <tr1/unordered_map>
-    typedef std::tr1::unordered_map<board_t, trans_table_entry_t> trans_table_t;
-#else
-    #include <map>
-    typedef std::map<board_t, trans_table_entry_t> trans_table_t;
-#endif
+#include "board.h"
+#include "huge_pages.h"
+#include "mcts.h"
+#include "rng.h"
+#include "move_cache.h"
+#include "ntuple.h"
+#include "tables.h"
+#include "thread_pool.h"
+#include "trans_table.h"
 
 /* MSVC compatibility: undefine max and min macros */
 #if defined(max)
@@ -30,196 +31,144 @@
 #undef min
 #endif
 
-// Transpose rows/columns in a board:
-//   0123       048c
-//   4567  -->  159d
-//   89ab       26ae
-//   cdef       37bf
-static inline board_t transpose(board_t x)
-{
-    board_t a1 = x & 0xF0F00F0FF0F00F0FULL;
-    board_t a2 = x & 0x0000F0F00000F0F0ULL;
-    board_t a3 = x & 0x0F0F00000F0F0000ULL;
-    board_t a = a1 | (a2 << 12) | (a3 >> 12);
-    board_t b1 = a & 0xFF00FF0000FF00FFULL;
-    board_t b2 = a & 0x00FF00FF00000000ULL;
-    board_t b3 = a & 0x00000000FF00FF00ULL;
-    return b1 | (b2 >> 24) | (b3 << 24);
-}
-
-// Count the number of empty positions (= zero nibbles) in a board.
-// Precondition: the board cannot be fully empty.
-static int count_empty(board_t x)
-{
-    x |= (x >> 2) & 0x3333333333333333ULL;
-    x |= (x >> 1);
-    x = ~x & 0x1111111111111111ULL;
-    // At this point each nibble is:
-    //  0 if the original nibble was non-zero
-    //  1 if the original nibble was zero
-    // Next sum them all
-    x += x >> 32;
-    x += x >> 16;
-    x += x >>  8;
-    x += x >>  4; // this can overflow to the next nibble if there were 16 empty positions
-    return x & 0xf;
-}
-
 /* We can perform state lookups one row at a time by using arrays with 65536 entries. */
 
 /* Move tables. Each row or compressed column is mapped to (oldrow^newrow) assuming row/col 0.
  *
  * Thus, the value is 0 if there is no move, and otherwise equals a value that can easily be
- * xor'ed into the current board state to update the board. */
-static row_t row_left_table [65536];
-static row_t row_right_table[65536];
-static board_t col_up_table[65536];
-static board_t col_down_table[65536];
-static float heur_score_table[65536];
-static float score_table[65536];
-
-// Heuristic scoring settings
-static const float SCORE_LOST_PENALTY = 200000.0f;
-static const float SCORE_MONOTONICITY_POWER = 4.0f;
-static const float SCORE_MONOTONICITY_WEIGHT = 47.0f;
-static const float SCORE_SUM_POWER = 3.5f;
-static const float SCORE_SUM_WEIGHT = 11.0f;
-static const float SCORE_MERGES_WEIGHT = 700.0f;
-static const float SCORE_EMPTY_WEIGHT = 270.0f;
-
-void init_tables() {
-    for (unsigned row = 0; row < 65536; ++row) {
-        unsigned line[4] = {
-                (row >>  0) & 0xf,
-                (row >>  4) & 0xf,
-                (row >>  8) & 0xf,
-                (row >> 12) & 0xf
-        };
-
-        // Score
-        float score = 0.0f;
-        for (int i = 0; i < 4; ++i) {
-            int rank = line[i];
-            if (rank >= 2) {
-                // the score is the total sum of the tile and all intermediate merged tiles
-                score += (rank - 1) * (1 << rank);
-            }
-        }
-        score_table[row] = score;
-
-
-        // Heuristic score
-        float sum = 0;
-        int empty = 0;
-        int merges = 0;
-
-        int prev = 0;
-        int counter = 0;
-        for (int i = 0; i < 4; ++i) {
-            int rank = line[i];
-            sum += pow(rank, SCORE_SUM_POWER);
-            if (rank == 0) {
-                empty++;
-            } else {
-                if (prev == rank) {
-                    counter++;
-                } else if (counter > 0) {
-                    merges += 1 + counter;
-                    counter = 0;
-                }
-                prev = rank;
-            }
-        }
-        if (counter > 0) {
-            merges += 1 + counter;
-        }
+ * xor'ed into the current board state to update the board.
+ *
+ * The tables are generated at build time (see tables.h and gentables.cpp):
+ *   row_left_table, row_right_table: padded by one entry, as the vector kernels gather 32 bits per row_t
+ *   col_up_table, col_down_table
+ *   score_table, heur_score_table
+ *   heur_score_upper_bound: an upper bound on the heuristic score of any board, and so on
+ *     the value of any node
+ *
+ * Building with COMPACT_TABLES replaces all but score_table with a single row_table of
+ * 8-byte {left, right, heur} entries: since unpack_col distributes over xor, a column move
+ * is just the row move unpacked into a column, so the column tables are not needed. That
+ * cuts the tables the search touches from 1.75 MB to 512 KB, and a lookup of one row brings
+ * in both of its moves and its heuristic score. */
+#include "bin/tables.inc"
+
+/* Where the search reads the tables: the compiled-in arrays, or their copies in a huge page
+ * (see use_huge_page_tables). */
+static struct {
+#ifdef COMPACT_TABLES
+    const row_entry_t *row;
+#else
+    const row_t *row_left;
+    const row_t *row_right;
+    const board_t *col_up;
+    const board_t *col_down;
+    const float *heur_score;
+#endif
+    const float *score;
+    int pages; // HUGE_PAGES_*
+} tables = {
+#ifdef COMPACT_TABLES
+    row_table,
+#else
+    row_left_table, row_right_table, col_up_table, col_down_table, heur_score_table,
+#endif
+    score_table, HUGE_PAGES_NONE,
+};
 
-        float monotonicity_left = 0;
-        float monotonicity_right = 0;
-        for (int i = 1; i < 4; ++i) {
-            if (line[i-1] > line[i]) {
-                monotonicity_left += pow(line[i-1], SCORE_MONOTONICITY_POWER) - pow(line[i], SCORE_MONOTONICITY_POWER);
-            } else {
-                monotonicity_right += pow(line[i], SCORE_MONOTONICITY_POWER) - pow(line[i-1], SCORE_MONOTONICITY_POWER);
-            }
-        }
+#ifdef COMPACT_TABLES
+static inline row_t row_left(unsigned row) { return tables.row[row].left; }
+static inline row_t row_right(unsigned row) { return tables.row[row].right; }
+static inline board_t col_up(unsigned row) { return unpack_col(tables.row[row].left); }
+static inline board_t col_down(unsigned row) { return unpack_col(tables.row[row].right); }
+static inline float row_heur(unsigned row) { return tables.row[row].heur; }
+#else
+static inline row_t row_left(unsigned row) { return tables.row_left[row]; }
+static inline row_t row_right(unsigned row) { return tables.row_right[row]; }
+static inline board_t col_up(unsigned row) { return tables.col_up[row]; }
+static inline board_t col_down(unsigned row) { return tables.col_down[row]; }
+static inline float row_heur(unsigned row) { return tables.heur_score[row]; }
+#endif
 
-        heur_score_table[row] = SCORE_LOST_PENALTY +
-            SCORE_EMPTY_WEIGHT * empty +
-            SCORE_MERGES_WEIGHT * merges -
-            SCORE_MONOTONICITY_WEIGHT * std::min(monotonicity_left, monotonicity_right) -
-            SCORE_SUM_WEIGHT * sum;
-
-        // execute a move to the left
-        for (int i = 0; i < 3; ++i) {
-            int j;
-            for (j = i + 1; j < 4; ++j) {
-                if (line[j] != 0) break;
-            }
-            if (j == 4) break; // no more tiles to the right
-
-            if (line[i] == 0) {
-                line[i] = line[j];
-                line[j] = 0;
-                i--; // retry this entry
-            } else if (line[i] == line[j]) {
-                if(line[i] != 0xf) {
-                    /* Pretend that 32768 + 32768 = 32768 (representational limit). */
-                    line[i]++;
-                }
-                line[j] = 0;
-            }
-        }
+// copy `src` to `*dst`, and return where the copy ends, 64-byte aligned
+template <typename T, size_t N>
+static char *copy_table(char *dst, const T (&src)[N], const T **copy) {
+    memcpy(dst, src, sizeof(src));
+    *copy = (const T *)dst;
+    return dst + ((sizeof(src) + 63) & ~size_t(63));
+}
 
-        row_t result = (line[0] <<  0) |
-                       (line[1] <<  4) |
-                       (line[2] <<  8) |
-                       (line[3] << 12);
-        row_t rev_result = reverse_row(result);
-        unsigned rev_row = reverse_row(row);
+static huge_buffer *table_memory = NULL; // of the copies
 
-        row_left_table [    row] =                row  ^                result;
-        row_right_table[rev_row] =            rev_row  ^            rev_result;
-        col_up_table   [    row] = unpack_col(    row) ^ unpack_col(    result);
-        col_down_table [rev_row] = unpack_col(rev_row) ^ unpack_col(rev_result);
+int use_huge_page_tables() {
+    if (tables.pages != HUGE_PAGES_NONE)
+        return tables.pages;
+#ifdef COMPACT_TABLES
+    size_t bytes = sizeof(row_table) + sizeof(score_table) + 2 * 64;
+#else
+    size_t bytes = sizeof(row_left_table) + sizeof(row_right_table) + sizeof(col_up_table) + sizeof(col_down_table) +
+        sizeof(heur_score_table) + sizeof(score_table) + 6 * 64;
+#endif
+    // never freed: a search may be reading it until the process exits
+    huge_buffer *memory = new huge_buffer();
+    if (!memory->allocate(bytes, true) || memory->pages == HUGE_PAGES_NONE) {
+        delete memory;
+        return HUGE_PAGES_NONE;
     }
+    char *p = (char *)memory->data;
+#ifdef COMPACT_TABLES
+    p = copy_table(p, row_table, &tables.row);
+#else
+    p = copy_table(p, row_left_table, &tables.row_left);
+    p = copy_table(p, row_right_table, &tables.row_right);
+    p = copy_table(p, col_up_table, &tables.col_up);
+    p = copy_table(p, col_down_table, &tables.col_down);
+    p = copy_table(p, heur_score_table, &tables.heur_score);
+#endif
+    copy_table(p, score_table, &tables.score);
+    tables.pages = memory->pages;
+    table_memory = memory;
+    return tables.pages;
+}
+
+void init_tables() {
+    // the tables are compiled in; nothing to do
 }
 
 static inline board_t execute_move_0(board_t board) {
     board_t ret = board;
     board_t t = transpose(board);
-    ret ^= col_up_table[(t >>  0) & ROW_MASK] <<  0;
-    ret ^= col_up_table[(t >> 16) & ROW_MASK] <<  4;
-    ret ^= col_up_table[(t >> 32) & ROW_MASK] <<  8;
-    ret ^= col_up_table[(t >> 48) & ROW_MASK] << 12;
+    ret ^= col_up((t >>  0) & ROW_MASK) <<  0;
+    ret ^= col_up((t >> 16) & ROW_MASK) <<  4;
+    ret ^= col_up((t >> 32) & ROW_MASK) <<  8;
+    ret ^= col_up((t >> 48) & ROW_MASK) << 12;
     return ret;
 }
 
 static inline board_t execute_move_1(board_t board) {
     board_t ret = board;
     board_t t = transpose(board);
-    ret ^= col_down_table[(t >>  0) & ROW_MASK] <<  0;
-    ret ^= col_down_table[(t >> 16) & ROW_MASK] <<  4;
-    ret ^= col_down_table[(t >> 32) & ROW_MASK] <<  8;
-    ret ^= col_down_table[(t >> 48) & ROW_MASK] << 12;
+    ret ^= col_down((t >>  0) & ROW_MASK) <<  0;
+    ret ^= col_down((t >> 16) & ROW_MASK) <<  4;
+    ret ^= col_down((t >> 32) & ROW_MASK) <<  8;
+    ret ^= col_down((t >> 48) & ROW_MASK) << 12;
     return ret;
 }
 
 static inline board_t execute_move_2(board_t board) {
     board_t ret = board;
-    ret ^= board_t(row_left_table[(board >>  0) & ROW_MASK]) <<  0;
-    ret ^= board_t(row_left_table[(board >> 16) & ROW_MASK]) << 16;
-    ret ^= board_t(row_left_table[(board >> 32) & ROW_MASK]) << 32;
-    ret ^= board_t(row_left_table[(board >> 48) & ROW_MASK]) << 48;
+    ret ^= board_t(row_left((board >>  0) & ROW_MASK)) <<  0;
+    ret ^= board_t(row_left((board >> 16) & ROW_MASK)) << 16;
+    ret ^= board_t(row_left((board >> 32) & ROW_MASK)) << 32;
+    ret ^= board_t(row_left((board >> 48) & ROW_MASK)) << 48;
     return ret;
 }
 
 static inline board_t execute_move_3(board_t board) {
     board_t ret = board;
-    ret ^= board_t(row_right_table[(board >>  0) & ROW_MASK]) <<  0;
-    ret ^= board_t(row_right_table[(board >> 16) & ROW_MASK]) << 16;
-    ret ^= board_t(row_right_table[(board >> 32) & ROW_MASK]) << 32;
-    ret ^= board_t(row_right_table[(board >> 48) & ROW_MASK]) << 48;
+    ret ^= board_t(row_right((board >>  0) & ROW_MASK)) <<  0;
+    ret ^= board_t(row_right((board >> 16) & ROW_MASK)) << 16;
+    ret ^= board_t(row_right((board >> 32) & ROW_MASK)) << 32;
+    ret ^= board_t(row_right((board >> 48) & ROW_MASK)) << 48;
     return ret;
 }
 
@@ -239,44 +188,276 @@ board_t execute_move(int move, board_t board) {
     }
 }
 
-static inline int get_max_rank(board_t board) {
-    int maxrank = 0;
-    while (board) {
-        maxrank = std::max(maxrank, int(board & 0xf));
-        board >>= 4;
+/* Expansion kernels: all four successors of a board at once, sharing a single transpose,
+ * plus a mask with bit `move` set when that move is legal. */
+static inline int expand_moves_scalar(board_t board, board_t *out) {
+    board_t t = transpose(board);
+    board_t up = board, down = board, left = board, right = board;
+    for (int i = 0; i < 4; ++i) {
+        up    ^= col_up  ((t >> (16 * i)) & ROW_MASK) << (4 * i);
+        down  ^= col_down((t >> (16 * i)) & ROW_MASK) << (4 * i);
+        left  ^= board_t(row_left ((board >> (16 * i)) & ROW_MASK)) << (16 * i);
+        right ^= board_t(row_right((board >> (16 * i)) & ROW_MASK)) << (16 * i);
     }
-    return maxrank;
+    out[0] = up;
+    out[1] = down;
+    out[2] = left;
+    out[3] = right;
+    return (up != board) | (down != board) << 1 | (left != board) << 2 | (right != board) << 3;
 }
 
-static inline int count_distinct_tiles(board_t board) {
-    uint16_t bitset = 0;
-    while (board) {
-        bitset |= 1<<(board & 0xf);
-        board >>= 4;
-    }
+static void expand_moves_batch_scalar(const board_t *boards, size_t n, board_t *out, uint8_t *masks) {
+    for (size_t i = 0; i < n; ++i)
+        masks[i] = expand_moves_scalar(boards[i], out + 4 * i);
+}
 
-    // Don't count empty tiles.
-    bitset >>= 1;
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_AVX2_KERNELS
+#include <immintrin.h>
+
+/* The AVX2 kernel expands four boards at a time with one board per 64-bit lane: the
+ * transpose is the scalar bit trick applied lane-wise, and each table lookup becomes a
+ * gather. SSE4 has no gathers, so anything below AVX2 uses the scalar kernel. */
+__attribute__((target("avx2")))
+static inline __m256i transpose_avx2(__m256i x) {
+    __m256i a1 = _mm256_and_si256(x, _mm256_set1_epi64x(0xF0F00F0FF0F00F0FULL));
+    __m256i a2 = _mm256_and_si256(x, _mm256_set1_epi64x(0x0000F0F00000F0F0ULL));
+    __m256i a3 = _mm256_and_si256(x, _mm256_set1_epi64x(0x0F0F00000F0F0000ULL));
+    __m256i a = _mm256_or_si256(a1, _mm256_or_si256(_mm256_slli_epi64(a2, 12), _mm256_srli_epi64(a3, 12)));
+    __m256i b1 = _mm256_and_si256(a, _mm256_set1_epi64x(0xFF00FF0000FF00FFULL));
+    __m256i b2 = _mm256_and_si256(a, _mm256_set1_epi64x(0x00FF00FF00000000ULL));
+    __m256i b3 = _mm256_and_si256(a, _mm256_set1_epi64x(0x00000000FF00FF00ULL));
+    return _mm256_or_si256(b1, _mm256_or_si256(_mm256_srli_epi64(b2, 24), _mm256_slli_epi64(b3, 24)));
+}
 
-    int count = 0;
-    while (bitset) {
-        bitset &= bitset - 1;
-        count++;
+__attribute__((target("avx2")))
+static void expand_moves_batch_avx2(const board_t *boards, size_t n, board_t *out, uint8_t *masks) {
+    const __m256i row_mask = _mm256_set1_epi64x(ROW_MASK);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i b = _mm256_loadu_si256((const __m256i *)(boards + i));
+        __m256i t = transpose_avx2(b);
+        __m256i up = b, down = b, left = b, right = b;
+
+#ifdef COMPACT_TABLES
+        // one 32-bit gather fetches both moves of a row; columns are unpacked from them
+        const __m256i col_mask = _mm256_set1_epi64x(COL_MASK);
+#define UNPACK_COL(x) _mm256_and_si256(_mm256_or_si256(_mm256_or_si256(x, _mm256_slli_epi64(x, 12)), \
+            _mm256_or_si256(_mm256_slli_epi64(x, 24), _mm256_slli_epi64(x, 36))), col_mask)
+#define EXPAND_ROW(k) do { \
+            __m256i tidx = _mm256_and_si256(_mm256_srli_epi64(t, 16 * k), row_mask); \
+            __m256i bidx = _mm256_and_si256(_mm256_srli_epi64(b, 16 * k), row_mask); \
+            __m256i tlr = _mm256_cvtepu32_epi64(_mm256_i64gather_epi32((const int *)tables.row, tidx, 8)); \
+            __m256i blr = _mm256_cvtepu32_epi64(_mm256_i64gather_epi32((const int *)tables.row, bidx, 8)); \
+            __m256i u = UNPACK_COL(_mm256_and_si256(tlr, row_mask)); \
+            __m256i d = UNPACK_COL(_mm256_srli_epi64(tlr, 16)); \
+            up = _mm256_xor_si256(up, _mm256_slli_epi64(u, 4 * k)); \
+            down = _mm256_xor_si256(down, _mm256_slli_epi64(d, 4 * k)); \
+            left = _mm256_xor_si256(left, _mm256_slli_epi64(_mm256_and_si256(blr, row_mask), 16 * k)); \
+            right = _mm256_xor_si256(right, _mm256_slli_epi64(_mm256_srli_epi64(blr, 16), 16 * k)); \
+        } while (0)
+#else
+#define EXPAND_ROW(k) do { \
+            __m256i tidx = _mm256_and_si256(_mm256_srli_epi64(t, 16 * k), row_mask); \
+            __m256i bidx = _mm256_and_si256(_mm256_srli_epi64(b, 16 * k), row_mask); \
+            up = _mm256_xor_si256(up, _mm256_slli_epi64(_mm256_i64gather_epi64((const long long *)tables.col_up, tidx, 8), 4 * k)); \
+            down = _mm256_xor_si256(down, _mm256_slli_epi64(_mm256_i64gather_epi64((const long long *)tables.col_down, tidx, 8), 4 * k)); \
+            __m256i l = _mm256_cvtepu32_epi64(_mm256_i64gather_epi32((const int *)tables.row_left, bidx, 2)); \
+            __m256i r = _mm256_cvtepu32_epi64(_mm256_i64gather_epi32((const int *)tables.row_right, bidx, 2)); \
+            left = _mm256_xor_si256(left, _mm256_slli_epi64(_mm256_and_si256(l, row_mask), 16 * k)); \
+            right = _mm256_xor_si256(right, _mm256_slli_epi64(_mm256_and_si256(r, row_mask), 16 * k)); \
+        } while (0)
+#endif
+        EXPAND_ROW(0);
+        EXPAND_ROW(1);
+        EXPAND_ROW(2);
+        EXPAND_ROW(3);
+#undef EXPAND_ROW
+#undef UNPACK_COL
+
+        // transpose the 4x4 block of (direction, board) lanes into per-board rows
+        __m256i ud_lo = _mm256_unpacklo_epi64(up, down);
+        __m256i ud_hi = _mm256_unpackhi_epi64(up, down);
+        __m256i lr_lo = _mm256_unpacklo_epi64(left, right);
+        __m256i lr_hi = _mm256_unpackhi_epi64(left, right);
+        __m256i res[4];
+        res[0] = _mm256_permute2x128_si256(ud_lo, lr_lo, 0x20);
+        res[1] = _mm256_permute2x128_si256(ud_hi, lr_hi, 0x20);
+        res[2] = _mm256_permute2x128_si256(ud_lo, lr_lo, 0x31);
+        res[3] = _mm256_permute2x128_si256(ud_hi, lr_hi, 0x31);
+
+        for (int j = 0; j < 4; ++j) {
+            _mm256_storeu_si256((__m256i *)(out + 4 * (i + j)), res[j]);
+            __m256i same = _mm256_cmpeq_epi64(res[j], _mm256_set1_epi64x(boards[i + j]));
+            masks[i + j] = ~_mm256_movemask_pd(_mm256_castsi256_pd(same)) & 0xf;
+        }
     }
-    return count;
+    expand_moves_batch_scalar(boards + i, n - i, out + 4 * i, masks + i);
 }
+#endif
 
 /* Optimizing the game */
 
+// memory used by a transposition table, unless the caller asks for something else
+static const unsigned DEFAULT_TRANS_TABLE_MB = 64;
+static size_t trans_table_max_bytes = size_t(DEFAULT_TRANS_TABLE_MB) << 20;
+
+void set_trans_table_size(unsigned megabytes) {
+    trans_table_max_bytes = size_t(megabytes) << 20;
+}
+
+class evaluator;
+
+static const int DEFAULT_SAMPLE_CELLS = 4;
+static const int DEFAULT_MCTS_PLAYOUTS = 10000;
+
+/* Search state that outlives a single search. The transposition table is shared by the
+ * four root moves and kept across consecutive turns of a game, since the next search
+ * mostly revisits positions from the previous tree. */
+struct search_context {
+    trans_table_t trans_table;
+    board_t root_board; // root of the most recent search
+    int threads; // threads working on each search
+    int verbose; // print each search's results
+    int max_depth; // cap on the search depth, or 0 for none
+    bool canonical_keys; // key the transposition table on canonical_board()
+    bool prune; // prune chance nodes that cannot change their parent's choice
+    int sample_empty; // sample the tile placements of boards with more empty cells than this; 0 = never
+    int sample_cells; // cells in each sample
+    evaluator *eval; // leaf evaluator, or NULL for the built-in heuristic
+    int eval_type; // EVALUATOR_*
+    heur_weights_t heur_weights; // weights of the heuristic, when it is the evaluator
+    move_cache *cache; // positions searched ahead of time, or NULL
+    int engine; // SEARCH_ENGINE_*
+    int mcts_playouts; // playouts of an MCTS search without another budget
+    int mcts_policy; // MCTS_PLAYOUT_*
+    mcts_tree *mcts; // node pool of the MCTS engine, allocated by its first search
+    bool huge_pages; // put the transposition table and the node pool in huge pages
+
+    explicit search_context(size_t trans_table_bytes) :
+        trans_table(trans_table_bytes), root_board(0), verbose(0), max_depth(0),
+        canonical_keys(false), prune(true), sample_empty(0), sample_cells(DEFAULT_SAMPLE_CELLS),
+        eval(NULL), eval_type(EVALUATOR_HEURISTIC), heur_weights(DEFAULT_HEUR_WEIGHTS), cache(NULL),
+        engine(SEARCH_ENGINE_EXPECTIMAX), mcts_playouts(DEFAULT_MCTS_PLAYOUTS),
+        mcts_policy(MCTS_PLAYOUT_GREEDY), mcts(NULL), huge_pages(false) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    ~search_context();
+};
+
+/* Budget of a time- or node-limited search, shared by every task working on it. Once it
+ * runs out, the nodes still being searched return early with meaningless values. */
+struct search_limit {
+    bool has_deadline;
+    std::chrono::steady_clock::time_point deadline;
+    uint64_t node_budget; // 0 for none
+    std::atomic<uint64_t> nodes; // moves evaluated so far, as reported by the tasks
+    std::atomic<bool> stop;
+
+    search_limit() : has_deadline(false), node_budget(0), nodes(0), stop(false) {
+    }
+};
+
+// moves a task evaluates between two looks at the clock and the shared node count
+static const unsigned long LIMIT_CHECK_INTERVAL = 4096;
+
 struct eval_state {
-    trans_table_t trans_table; // transposition table, to cache previously-seen moves
+    trans_table_t &trans_table; // transposition table, to cache previously-seen moves
+    thread_pool *pool; // pool to split the search over, or NULL to search serially
+    search_limit *limit; // budget of the search, or NULL for none
+    unsigned long limit_checked; // moves_evaled already added to limit->nodes
     int maxdepth;
     int curdepth;
-    int cachehits;
+    unsigned long cacheprobes;
+    unsigned long cachehits;
     unsigned long moves_evaled;
+    unsigned long tt_stores;
+    unsigned long tt_overwrites;
+    unsigned long leaf_evals;
+    unsigned long prob_cutoffs;
+    unsigned long depth_cutoffs;
+    unsigned long prune_cutoffs;
+    unsigned long sampled_nodes;
+    unsigned long nodes_by_depth[SEARCH_STATS_MAX_DEPTH]; // moves_evaled by depth
     int depth_limit;
+    bool reached_limit; // some part of the tree was cut off by depth_limit rather than by probability
+    bool canonical_keys;
+    bool prune; // cut off chance nodes that cannot beat a sibling (see score_tilechoose_node)
+    int sample_empty; // sample the tile placements of boards with more empty cells than this (see spawn_cells); 0 = never
+    int sample_cells;
+    const evaluator *eval; // leaf evaluator, or NULL for the built-in heuristic
+
+    explicit eval_state(trans_table_t &trans_table) :
+        trans_table(trans_table), pool(NULL), limit(NULL), limit_checked(0),
+        maxdepth(0), curdepth(0), cacheprobes(0), cachehits(0), moves_evaled(0),
+        tt_stores(0), tt_overwrites(0), leaf_evals(0),
+        prob_cutoffs(0), depth_cutoffs(0), prune_cutoffs(0), sampled_nodes(0),
+        depth_limit(0), reached_limit(false),
+        canonical_keys(false), prune(false), sample_empty(0), sample_cells(0), eval(NULL) {
+        memset(nodes_by_depth, 0, sizeof(nodes_by_depth));
+    }
+
+    // state for a subtree handed to another task: same position in the tree, fresh statistics
+    eval_state fork() const {
+        eval_state child(trans_table);
+        child.pool = pool;
+        child.limit = limit;
+        child.curdepth = curdepth;
+        child.depth_limit = depth_limit;
+        child.canonical_keys = canonical_keys;
+        child.prune = prune;
+        child.sample_empty = sample_empty;
+        child.sample_cells = sample_cells;
+        child.eval = eval;
+        return child;
+    }
+
+    // fold in the statistics of a subtree searched by another task
+    void merge(const eval_state &child) {
+        maxdepth = std::max(maxdepth, child.maxdepth);
+        cacheprobes += child.cacheprobes;
+        cachehits += child.cachehits;
+        moves_evaled += child.moves_evaled;
+        tt_stores += child.tt_stores;
+        tt_overwrites += child.tt_overwrites;
+        leaf_evals += child.leaf_evals;
+        prob_cutoffs += child.prob_cutoffs;
+        depth_cutoffs += child.depth_cutoffs;
+        prune_cutoffs += child.prune_cutoffs;
+        sampled_nodes += child.sampled_nodes;
+        for (int d = 0; d < SEARCH_STATS_MAX_DEPTH; d++)
+            nodes_by_depth[d] += child.nodes_by_depth[d];
+        reached_limit |= child.reached_limit;
+        limit_checked += child.limit_checked;
+    }
+
+    // a move node `depth` moves below the root, whose four moves are evaluated
+    void count_move_node(int depth) {
+        moves_evaled += 4;
+        nodes_by_depth[std::min(depth, (int)SEARCH_STATS_MAX_DEPTH - 1)] += 4;
+    }
+
+    void store(board_t key, float heuristic, bool upper_bound) {
+        trans_table_t::store_result result = trans_table.store(key, depth_limit - curdepth, heuristic, upper_bound);
+        tt_stores += result != trans_table_t::STORE_REJECTED;
+        tt_overwrites += result == trans_table_t::STORE_EVICTED;
+    }
 
-    eval_state() : maxdepth(0), curdepth(0), cachehits(0), moves_evaled(0), depth_limit(0) {
+    // whether the search has run out of its budget; only looks at the clock every so often
+    bool out_of_budget() {
+        if (limit->stop.load(std::memory_order_relaxed))
+            return true;
+        if (moves_evaled - limit_checked < LIMIT_CHECK_INTERVAL)
+            return false;
+        uint64_t nodes = limit->nodes.fetch_add(moves_evaled - limit_checked, std::memory_order_relaxed) + (moves_evaled - limit_checked);
+        limit_checked = moves_evaled;
+        if ((limit->node_budget && nodes >= limit->node_budget) ||
+            (limit->has_deadline && std::chrono::steady_clock::now() >= limit->deadline)) {
+            limit->stop.store(true, std::memory_order_relaxed);
+            return true;
+        }
+        return false;
     }
 };
 
@@ -286,8 +467,12 @@ static float score_heur_board(board_t board);
 static float score_board(board_t board);
 // score over all possible moves
 static float score_move_node(eval_state &state, board_t board, float cprob);
-// score over all possible tile choices and placements
-static float score_tilechoose_node(eval_state &state, board_t board, float cprob);
+// same, given the successors and legal-move mask from the expansion kernels
+static float score_expanded_move_node(eval_state &state, const board_t *newboards, int legal, float cprob, float alpha = -INFINITY);
+// same, when every successor is a leaf whose score has already been computed
+static float score_leaf_move_node(eval_state &state, int legal, const float *&scores);
+// score over all possible tile choices and placements; a result <= alpha only bounds the score from above
+static float score_tilechoose_node(eval_state &state, board_t board, float cprob, float alpha);
 
 
 static float score_helper(board_t board, const float* table) {
@@ -297,13 +482,231 @@ static float score_helper(board_t board, const float* table) {
            table[(board >> 48) & ROW_MASK];
 }
 
+static float score_heur_helper(board_t board) {
+    return row_heur((board >>  0) & ROW_MASK) +
+           row_heur((board >> 16) & ROW_MASK) +
+           row_heur((board >> 32) & ROW_MASK) +
+           row_heur((board >> 48) & ROW_MASK);
+}
+
 static float score_heur_board(board_t board) {
-    return score_helper(          board , heur_score_table) +
-           score_helper(transpose(board), heur_score_table);
+    return score_heur_helper(          board ) +
+           score_heur_helper(transpose(board));
 }
 
 static float score_board(board_t board) {
-    return score_helper(board, score_table);
+    return score_helper(board, tables.score);
+}
+
+// same as score_heur_board, with the row scores of a heur_table
+static float score_heur_board_table(board_t board, const float *table) {
+    return score_helper(          board , table) +
+           score_helper(transpose(board), table);
+}
+
+/* Leaf evaluation kernels: score_heur_board, or score_heur_board_table, over an array of boards. */
+static void score_heur_boards_scalar(const board_t *boards, size_t n, float *out) {
+    for (size_t i = 0; i < n; ++i)
+        out[i] = score_heur_board(boards[i]);
+}
+
+static void score_heur_table_boards_scalar(const float *table, const board_t *boards, size_t n, float *out) {
+    for (size_t i = 0; i < n; ++i)
+        out[i] = score_heur_board_table(boards[i], table);
+}
+
+#ifdef HAVE_AVX2_KERNELS
+/* Four boards at a time, one per lane, so that the eight table lookups of each board are
+ * issued as eight independent gathers. Each lane adds its rows in the same order as
+ * score_heur_board, so the results are bit-for-bit identical to the scalar kernel. The row
+ * scores are read from `table`, SCALE bytes apart. */
+template <int SCALE>
+__attribute__((target("avx2")))
+static inline __m128 score_heur_avx2(const float *table, __m256i b) {
+    const __m256i row_mask = _mm256_set1_epi64x(ROW_MASK);
+    __m256i t = transpose_avx2(b);
+#define HEUR_ROW(x, k) _mm256_i64gather_ps(table, _mm256_and_si256(_mm256_srli_epi64(x, 16 * k), row_mask), SCALE)
+    __m128 rows = _mm_add_ps(_mm_add_ps(_mm_add_ps(HEUR_ROW(b, 0), HEUR_ROW(b, 1)), HEUR_ROW(b, 2)), HEUR_ROW(b, 3));
+    __m128 cols = _mm_add_ps(_mm_add_ps(_mm_add_ps(HEUR_ROW(t, 0), HEUR_ROW(t, 1)), HEUR_ROW(t, 2)), HEUR_ROW(t, 3));
+#undef HEUR_ROW
+    return _mm_add_ps(rows, cols);
+}
+
+__attribute__((target("avx2")))
+static void score_heur_boards_avx2(const board_t *boards, size_t n, float *out) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256i b = _mm256_loadu_si256((const __m256i *)(boards + i));
+#ifdef COMPACT_TABLES
+        _mm_storeu_ps(out + i, score_heur_avx2<sizeof(row_entry_t)>(&tables.row[0].heur, b));
+#else
+        _mm_storeu_ps(out + i, score_heur_avx2<sizeof(float)>(tables.heur_score, b));
+#endif
+    }
+    score_heur_boards_scalar(boards + i, n - i, out + i);
+}
+
+__attribute__((target("avx2")))
+static void score_heur_table_boards_avx2(const float *table, const board_t *boards, size_t n, float *out) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        _mm_storeu_ps(out + i, score_heur_avx2<sizeof(float)>(table, _mm256_loadu_si256((const __m256i *)(boards + i))));
+    score_heur_table_boards_scalar(table, boards + i, n - i, out + i);
+}
+#endif
+
+/* Kernel selection */
+
+typedef void (*expand_moves_batch_func_t)(const board_t *, size_t, board_t *, uint8_t *);
+typedef void (*score_heur_boards_func_t)(const board_t *, size_t, float *);
+typedef void (*score_heur_table_boards_func_t)(const float *, const board_t *, size_t, float *);
+
+static int detect_kernel_isa() {
+#ifdef HAVE_AVX2_KERNELS
+    if (__builtin_cpu_supports("avx2"))
+        return KERNEL_ISA_AVX2;
+#endif
+    return KERNEL_ISA_SCALAR;
+}
+
+static int kernel_isa = detect_kernel_isa();
+
+static expand_moves_batch_func_t expand_moves_batch_impl(int isa) {
+#ifdef HAVE_AVX2_KERNELS
+    if (isa == KERNEL_ISA_AVX2)
+        return expand_moves_batch_avx2;
+#endif
+    (void)isa;
+    return expand_moves_batch_scalar;
+}
+
+static score_heur_boards_func_t score_heur_boards_impl(int isa) {
+#ifdef HAVE_AVX2_KERNELS
+    if (isa == KERNEL_ISA_AVX2)
+        return score_heur_boards_avx2;
+#endif
+    (void)isa;
+    return score_heur_boards_scalar;
+}
+
+static score_heur_table_boards_func_t score_heur_table_boards_impl(int isa) {
+#ifdef HAVE_AVX2_KERNELS
+    if (isa == KERNEL_ISA_AVX2)
+        return score_heur_table_boards_avx2;
+#endif
+    (void)isa;
+    return score_heur_table_boards_scalar;
+}
+
+static expand_moves_batch_func_t expand_moves_batch_func = expand_moves_batch_impl(kernel_isa);
+static score_heur_boards_func_t score_heur_boards_func = score_heur_boards_impl(kernel_isa);
+static score_heur_table_boards_func_t score_heur_table_boards_func = score_heur_table_boards_impl(kernel_isa);
+
+int get_kernel_isa() {
+    return kernel_isa;
+}
+
+int set_kernel_isa(int isa) {
+    kernel_isa = std::max((int)KERNEL_ISA_SCALAR, std::min(isa, detect_kernel_isa()));
+    expand_moves_batch_func = expand_moves_batch_impl(kernel_isa);
+    score_heur_boards_func = score_heur_boards_impl(kernel_isa);
+    score_heur_table_boards_func = score_heur_table_boards_impl(kernel_isa);
+    return kernel_isa;
+}
+
+int expand_moves(board_t board, board_t *out) {
+    return expand_moves_scalar(board, out);
+}
+
+void expand_moves_batch(const board_t *boards, size_t n, board_t *out, uint8_t *masks) {
+    expand_moves_batch_func(boards, n, out, masks);
+}
+
+void score_heur_boards(const board_t *boards, size_t n, float *out) {
+    score_heur_boards_func(boards, n, out);
+}
+
+/* Leaf evaluators that replace the built-in heuristic (see set_heur_weights and
+ * set_ntuple_network). A search scores every board it does not expand, and orders its
+ * moves, with its context's evaluator if there is one. */
+class evaluator {
+public:
+    float upper_bound; // on the score of any board, for the pruning in score_tilechoose_node
+
+    virtual ~evaluator() {
+    }
+
+    virtual float evaluate(board_t board) const = 0;
+    virtual void evaluate_batch(const board_t *boards, size_t n, float *out) const = 0;
+};
+
+/* The heuristic with weights other than the built-in ones, in a table built at runtime. */
+class heur_table : public evaluator {
+public:
+    explicit heur_table(const heur_weights_t &weights) {
+        float max_score = -INFINITY;
+        for (unsigned row = 0; row < 65536; ++row) {
+            scores[row] = row_heur_score(row, weights);
+            max_score = std::max(max_score, scores[row]);
+        }
+        upper_bound = heur_score_bound(max_score);
+    }
+
+    float evaluate(board_t board) const {
+        return score_heur_board_table(board, scores);
+    }
+
+    void evaluate_batch(const board_t *boards, size_t n, float *out) const {
+        score_heur_table_boards_func(scores, boards, n, out);
+    }
+
+private:
+    float scores[65536];
+};
+
+/* An n-tuple network (see ntuple.h). The network values a board by the score still to be
+ * made from it, so the evaluator adds the score made so far: then the leaves below a move
+ * also differ by the merges made on the way to them, as they would in a real game. */
+class ntuple_evaluator : public evaluator {
+public:
+    explicit ntuple_evaluator(ntuple_network *net) : net(net) {
+        float max_row_score = *std::max_element(score_table, score_table + 65536);
+        upper_bound = (net->max_value() + 4 * max_row_score) * 1.00001f;
+    }
+
+    ~ntuple_evaluator() {
+        delete net;
+    }
+
+    float evaluate(board_t board) const {
+        // a lost game scores 0, so no board may score below it
+        return std::max(0.0f, net->value(board) + score_board(board));
+    }
+
+    void evaluate_batch(const board_t *boards, size_t n, float *out) const {
+        for (size_t i = 0; i < n; ++i)
+            out[i] = evaluate(boards[i]);
+    }
+
+private:
+    ntuple_network *net;
+};
+
+static inline float evaluate_board(eval_state &state, board_t board) {
+    state.leaf_evals++;
+    return state.eval ? state.eval->evaluate(board) : score_heur_board(board);
+}
+
+static inline void evaluate_boards(eval_state &state, const board_t *boards, size_t n, float *out) {
+    state.leaf_evals += n;
+    if (state.eval)
+        state.eval->evaluate_batch(boards, n, out);
+    else
+        score_heur_boards_func(boards, n, out);
+}
+
+static inline float evaluate_upper_bound(const eval_state &state) {
+    return state.eval ? state.eval->upper_bound : heur_score_upper_bound;
 }
 
 // Statistics and controls
@@ -311,63 +714,272 @@ static float score_board(board_t board) {
 // don't recurse into a node with a cprob less than this threshold
 static const float CPROB_THRESH_BASE = 0.0001f;
 static const int CACHE_DEPTH_LIMIT  = 15;
+// chance nodes this close to the root hand their children out to the thread pool,
+// as long as enough depth remains below them to be worth a task
+static const int PARALLEL_SPLIT_DEPTH = 2;
+static const int PARALLEL_MIN_REMAINING = 3;
+
+struct move_node_task {
+    eval_state state;
+    board_t board;
+    float cprob;
+    float result;
+
+    move_node_task(const eval_state &state, board_t board, float cprob) : state(state), board(board), cprob(cprob), result(0) {
+    }
+};
 
-static float score_tilechoose_node(eval_state &state, board_t board, float cprob) {
+static void run_move_node_task(void *arg) {
+    move_node_task *task = (move_node_task *)arg;
+    task->result = score_move_node(task->state, task->board, task->cprob);
+}
+
+// same as the loop in score_tilechoose_node, with every tile placement searched as its own task
+static float score_tilechoose_children_parallel(eval_state &state, board_t board, const board_t *cells, int ncells, float cprob) {
+    std::vector<move_node_task> tasks;
+    tasks.reserve(32);
+
+    for (int i = 0; i < ncells; ++i) {
+        tasks.push_back(move_node_task(state.fork(), board |  cells[i]      , cprob * 0.9f));
+        tasks.push_back(move_node_task(state.fork(), board | (cells[i] << 1), cprob * 0.1f));
+    }
+
+    task_group group;
+    for (size_t i = 0; i < tasks.size(); ++i)
+        state.pool->spawn(group, run_move_node_task, &tasks[i]);
+    state.pool->wait(group);
+
+    float res = 0.0f;
+    for (size_t i = 0; i < tasks.size(); i += 2) {
+        res += tasks[i].result * 0.9f;
+        res += tasks[i + 1].result * 0.1f;
+        state.merge(tasks[i].state);
+        state.merge(tasks[i + 1].state);
+    }
+    return res;
+}
+
+// one of the 8 rotations and reflections of a board, as canonical_board tries them
+static inline board_t apply_symmetry(int symmetry, board_t x) {
+    if (symmetry & 1)
+        x = mirror_rows(x);
+    if (symmetry & 2)
+        x = mirror_cols(x);
+    if (symmetry & 4)
+        x = transpose(x);
+    return x;
+}
+
+/* The cells a chance node places its tile in, as the 2 tile in each (the 4 tile is the 2
+ * shifted left by one). On boards with more than state.sample_empty empty cells, only
+ * state.sample_cells of them are searched, as a systematic sample: evenly spaced among the
+ * empty cells, from an offset drawn from the hash of the board's transposition table key,
+ * so that each cell is equally likely to be in the sample and a board always gets the same
+ * one. With canonical keys, the empty cells are taken in their order on the canonical
+ * board, so symmetric boards, which share an entry, also sample the same cells up to the
+ * symmetry. Each sampled cell still gets both tiles. */
+static int spawn_cells(eval_state &state, board_t board, board_t key, int num_open, board_t *cells) {
+    int n = 0;
+    board_t tmp = board;
+    board_t tile_2 = 1;
+    while (tile_2) {
+        if ((tmp & 0xf) == 0)
+            cells[n++] = tile_2;
+        tmp >>= 4;
+        tile_2 <<= 4;
+    }
+    if (!state.sample_empty || num_open <= state.sample_empty || num_open <= state.sample_cells)
+        return n;
+
+    state.sampled_nodes++;
+    if (key != board) {
+        int symmetry = 1;
+        while (symmetry < 7 && apply_symmetry(symmetry, board) != key)
+            symmetry++;
+        // sort by where each cell lands on the key (a cell is a one-tile board, so its value orders it)
+        board_t places[16];
+        for (int i = 0; i < n; ++i) {
+            board_t cell = cells[i], place = apply_symmetry(symmetry, cell);
+            int j = i;
+            for (; j > 0 && places[j - 1] > place; --j) {
+                places[j] = places[j - 1];
+                cells[j] = cells[j - 1];
+            }
+            places[j] = place;
+            cells[j] = cell;
+        }
+    }
+    float stride = (float)num_open / state.sample_cells;
+    float offset = (trans_table_hash(key) >> 40) * (1.0f / (1 << 24)) * stride;
+    // each picked index is at least i, so the cells can be compacted in place
+    for (int i = 0; i < state.sample_cells; ++i)
+        cells[i] = cells[std::min(num_open - 1, (int)(offset + i * stride))];
+    return state.sample_cells;
+}
+
+/* With pruning on, a chance node is given alpha, the best score its parent move node has
+ * found so far (Ballard's Star1, with no upper window since there are no min nodes). Every
+ * node's score is at most heur_score_upper_bound (or its evaluator's upper_bound),
+ * so once the children scored so far plus that bound for the ones left cannot exceed
+ * alpha, the node returns alpha: its parent will not pick it, whatever its exact score.
+ * A child that got cut the same way makes its parent cut as well, so an uncut node's score
+ * is exact. A cut node stores alpha in the transposition table as an upper bound, which a
+ * later visit can reuse if its own alpha is at least as high. */
+static float score_tilechoose_node(eval_state &state, board_t board, float cprob, float alpha) {
+    if (state.limit && state.out_of_budget())
+        return 0.0f;
     if (cprob < CPROB_THRESH_BASE || state.curdepth >= state.depth_limit) {
         state.maxdepth = std::max(state.curdepth, state.maxdepth);
-        return score_heur_board(board);
+        if (state.curdepth >= state.depth_limit) {
+            state.reached_limit = true;
+            state.depth_cutoffs++;
+        } else
+            state.prob_cutoffs++;
+        return evaluate_board(state, board);
     }
+    board_t key = state.canonical_keys ? canonical_board(board) : board;
     if (state.curdepth < CACHE_DEPTH_LIMIT) {
-        const trans_table_t::iterator &i = state.trans_table.find(board);
-        if (i != state.trans_table.end()) {
-            trans_table_entry_t entry = i->second;
-            /*
-            return heuristic from transposition table only if it means that
-            the node will have been evaluated to a minimum depth of state.depth_limit.
-            This will result in slightly fewer cache hits, but should not impact the
-            strength of the ai negatively.
-            */
-            if(entry.depth <= state.curdepth)
-            {
-                state.cachehits++;
-                return entry.heuristic;
-            }
+        /*
+        return heuristic from transposition table only if it means that
+        the node will have been evaluated to a minimum depth of state.depth_limit.
+        This will result in slightly fewer cache hits, but should not impact the
+        strength of the ai negatively.
+        */
+        float heuristic;
+        bool upper_bound = false;
+        state.cacheprobes++;
+        // an upper bound left by an earlier cutoff is only a hit if it allows the same cutoff here
+        if (state.trans_table.lookup(key, state.depth_limit - state.curdepth, heuristic, state.prune ? &upper_bound : NULL) &&
+            (!upper_bound || heuristic <= alpha)) {
+            state.cachehits++;
+            // the entry was searched to at least depth_limit
+            state.reached_limit = true;
+            return upper_bound ? alpha : heuristic;
         }
     }
 
     int num_open = count_empty(board);
+    // a sampled cell stands for several, but its subtree is cut off at its own probability
     cprob /= num_open;
+    board_t cells[16];
+    int ncells = spawn_cells(state, board, key, num_open, cells);
 
     float res = 0.0f;
-    board_t tmp = board;
-    board_t tile_2 = 1;
-    while (tile_2) {
-        if ((tmp & 0xf) == 0) {
-            res += score_move_node(state, board |  tile_2      , cprob * 0.9f) * 0.9f;
-            res += score_move_node(state, board | (tile_2 << 1), cprob * 0.1f) * 0.1f;
+    bool cut = false;
+    if (state.pool && state.curdepth < PARALLEL_SPLIT_DEPTH && state.depth_limit - state.curdepth >= PARALLEL_MIN_REMAINING) {
+        res = score_tilechoose_children_parallel(state, board, cells, ncells, cprob);
+    } else {
+        // generate the moves of every tile placement in one batch
+        board_t children[32];
+        board_t newboards[32 * 4];
+        uint8_t legal[32];
+        int nchildren = 0;
+
+        for (int i = 0; i < ncells; ++i) {
+            children[nchildren++] = board |  cells[i];
+            children[nchildren++] = board | (cells[i] << 1);
         }
-        tmp >>= 4;
-        tile_2 <<= 4;
+
+        // a node that may be pruned partway through expands its children a few at a time,
+        // and scores each child's leaves in turn, so that a cutoff skips that work too;
+        // otherwise all the leaves are collected and scored in one batch
+        bool lazy = alpha > -INFINITY;
+        if (!lazy)
+            expand_moves_batch(children, nchildren, newboards, legal);
+
+        bool leaf_2 = state.curdepth + 1 >= state.depth_limit || cprob * 0.9f < CPROB_THRESH_BASE;
+        bool leaf_4 = state.curdepth + 1 >= state.depth_limit || cprob * 0.1f < CPROB_THRESH_BASE;
+        state.reached_limit |= state.curdepth + 1 >= state.depth_limit;
+        board_t leaves[32 * 4];
+        float leaf_scores[32 * 4];
+        int nleaves = 0;
+        if ((leaf_2 || leaf_4) && !lazy) {
+            for (int i = 0; i < nchildren; ++i) {
+                if (!((i & 1) ? leaf_4 : leaf_2))
+                    continue;
+                for (int move = 0; move < 4; ++move) {
+                    if (legal[i] & (1 << move))
+                        leaves[nleaves++] = newboards[4 * i + move];
+                }
+            }
+            evaluate_boards(state, leaves, nleaves, leaf_scores);
+        }
+
+        // res and the probability mass are kept unnormalized (out of ncells), like alpha here
+        float scaled_alpha = alpha * ncells;
+        const float *leaf_score = leaf_scores;
+        for (int i = 0; i < nchildren; ++i) {
+            float prob = (i & 1) ? 0.1f : 0.9f;
+            // the cells after this one, plus the 4 in this cell if this is its 2
+            float mass_left = ((nchildren - i - 1) >> 1) + ((i & 1) ? 0.0f : 0.1f);
+            float child_alpha = (scaled_alpha - res - mass_left * evaluate_upper_bound(state)) / prob;
+            float child;
+            if (lazy && (i & 3) == 0)
+                expand_moves_batch(children + i, std::min(4, nchildren - i), newboards + 4 * i, legal + i);
+            if ((i & 1) ? leaf_4 : leaf_2) {
+                if (lazy) {
+                    nleaves = 0;
+                    for (int move = 0; move < 4; ++move) {
+                        if (legal[i] & (1 << move))
+                            leaves[nleaves++] = newboards[4 * i + move];
+                    }
+                    evaluate_boards(state, leaves, nleaves, leaf_scores);
+                    leaf_score = leaf_scores;
+                }
+                child = score_leaf_move_node(state, legal[i], leaf_score);
+            } else
+                child = score_expanded_move_node(state, newboards + 4 * i, legal[i], cprob * prob, child_alpha);
+            if (child <= child_alpha) {
+                cut = true;
+                break;
+            }
+            res += child * prob;
+        }
+    }
+    if (cut) {
+        if (state.curdepth < CACHE_DEPTH_LIMIT && !(state.limit && state.limit->stop.load(std::memory_order_relaxed)))
+            state.store(key, alpha, true);
+        state.prune_cutoffs++;
+        return alpha;
     }
-    res = res / num_open;
+    res = res / ncells;
 
-    if (state.curdepth < CACHE_DEPTH_LIMIT) {
-        trans_table_entry_t entry = {static_cast<uint8_t>(state.curdepth), res};
-        state.trans_table[board] = entry;
+    // a value computed after the budget ran out may be missing parts of its subtree
+    if (state.curdepth < CACHE_DEPTH_LIMIT && !(state.limit && state.limit->stop.load(std::memory_order_relaxed))) {
+        state.store(key, res, false);
     }
 
     return res;
 }
 
-static float score_move_node(eval_state &state, board_t board, float cprob) {
+static float score_expanded_move_node(eval_state &state, const board_t *newboards, int legal, float cprob, float alpha) {
     float best = 0.0f;
     state.curdepth++;
-    for (int move = 0; move < 4; ++move) {
-        board_t newboard = execute_move(move, board);
-        state.moves_evaled++;
-
-        if (board != newboard) {
-            best = std::max(best, score_tilechoose_node(state, newboard, cprob));
+    state.count_move_node(state.curdepth);
+    if (state.prune) {
+        // the cutoffs are tighter once a strong move has set alpha, so try the moves best-first
+        // by their heuristic score
+        int order[4];
+        float heur[4];
+        int n = 0;
+        for (int move = 0; move < 4; ++move) {
+            if (legal & (1 << move)) {
+                float h = evaluate_board(state, newboards[move]);
+                int j = n++;
+                for (; j > 0 && heur[j - 1] < h; --j) {
+                    heur[j] = heur[j - 1];
+                    order[j] = order[j - 1];
+                }
+                heur[j] = h;
+                order[j] = move;
+            }
+        }
+        for (int i = 0; i < n; ++i)
+            best = std::max(best, score_tilechoose_node(state, newboards[order[i]], cprob, std::max(alpha, best)));
+    } else {
+        for (int move = 0; move < 4; ++move) {
+            if (legal & (1 << move))
+                best = std::max(best, score_tilechoose_node(state, newboards[move], cprob, -INFINITY));
         }
     }
     state.curdepth--;
@@ -375,57 +987,995 @@ static float score_move_node(eval_state &state, board_t board, float cprob) {
     return best;
 }
 
-static float _score_toplevel_move(eval_state &state, board_t board, int move) {
+// the successors' scores were computed in a batch; the ones belonging to this node are consumed from `scores`
+static float score_leaf_move_node(eval_state &state, int legal, const float *&scores) {
+    float best = 0.0f;
+    state.count_move_node(state.curdepth + 1);
+    if (legal)
+        state.maxdepth = std::max(state.curdepth + 1, state.maxdepth);
+    // each successor is a chance node cut off, like the first branch of score_tilechoose_node
+    unsigned long &cutoffs = (state.curdepth + 1 >= state.depth_limit) ? state.depth_cutoffs : state.prob_cutoffs;
+    for (int move = 0; move < 4; ++move) {
+        if (legal & (1 << move)) {
+            best = std::max(best, *scores++);
+            cutoffs++;
+        }
+    }
+
+    return best;
+}
+
+static float score_move_node(eval_state &state, board_t board, float cprob) {
+    board_t newboards[4];
+    int legal = expand_moves_scalar(board, newboards);
+    return score_expanded_move_node(state, newboards, legal, cprob);
+}
+
+// *score gets the search's own score, which alpha is compared with, and *upper_bound is set if
+// the move was pruned against alpha: its score is then only known to be <= alpha
+static float _score_toplevel_move(eval_state &state, board_t board, int move, float alpha, float *score, bool *upper_bound) {
     //int maxrank = get_max_rank(board);
     board_t newboard = execute_move(move, board);
 
+    *score = 0;
+    *upper_bound = false;
     if(board == newboard)
         return 0;
 
-    return score_tilechoose_node(state, newboard, 1.0f) + 1e-6;
+    *score = score_tilechoose_node(state, newboard, 1.0f, alpha);
+    *upper_bound = *score <= alpha;
+    return *score + 1e-6;
 }
 
-float score_toplevel_move(board_t board, int move) {
-    float res;
-    struct timeval start, finish;
-    double elapsed;
+search_context_t *create_search_context(unsigned trans_table_mb) {
+    return new search_context(trans_table_mb ? size_t(trans_table_mb) << 20 : trans_table_max_bytes);
+}
+
+void reset_search_context(search_context_t *ctx) {
+    ctx->trans_table.clear();
+    ctx->root_board = 0;
+}
+
+void free_search_context(search_context_t *ctx) {
+    delete ctx;
+}
+
+search_context::~search_context() {
+    delete eval;
+    delete cache;
+    delete mcts;
+}
+
+/* The context used by the context-less entry points. */
+static search_context &default_search_context() {
+    static search_context ctx(trans_table_max_bytes);
+    return ctx;
+}
+
+void set_search_option(search_context_t *ctx, int option, int value) {
+    search_context &c = ctx ? *ctx : default_search_context();
+    switch(option) {
+    case SEARCH_OPT_THREADS:
+        c.threads = (value > 0) ? value : std::max(1u, std::thread::hardware_concurrency());
+        break;
+    case SEARCH_OPT_VERBOSE:
+        c.verbose = value;
+        break;
+    case SEARCH_OPT_MAX_DEPTH:
+        c.max_depth = std::max(0, value);
+        break;
+    case SEARCH_OPT_CANONICAL_KEYS:
+        c.canonical_keys = (value != 0);
+        break;
+    case SEARCH_OPT_PRUNE:
+        c.prune = (value != 0);
+        break;
+    case SEARCH_OPT_SAMPLE_EMPTY:
+        c.sample_empty = std::max(0, value);
+        break;
+    case SEARCH_OPT_SAMPLE_CELLS:
+        c.sample_cells = std::max(1, value);
+        break;
+    case SEARCH_OPT_ENGINE:
+        c.engine = (value == SEARCH_ENGINE_MCTS) ? SEARCH_ENGINE_MCTS : SEARCH_ENGINE_EXPECTIMAX;
+        break;
+    case SEARCH_OPT_MCTS_PLAYOUTS:
+        c.mcts_playouts = std::max(1, value);
+        break;
+    case SEARCH_OPT_MCTS_POLICY:
+        c.mcts_policy = (value == MCTS_PLAYOUT_RANDOM) ? MCTS_PLAYOUT_RANDOM : MCTS_PLAYOUT_GREEDY;
+        break;
+    case SEARCH_OPT_HUGE_PAGES:
+        if (c.huge_pages != (value != 0)) {
+            c.huge_pages = (value != 0);
+            c.trans_table.set_huge_pages(c.huge_pages);
+            c.root_board = 0;
+            // reallocated by the next MCTS search
+            delete c.mcts;
+            c.mcts = NULL;
+        }
+        break;
+    }
+}
+
+int get_search_option(search_context_t *ctx, int option) {
+    search_context &c = ctx ? *ctx : default_search_context();
+    switch(option) {
+    case SEARCH_OPT_THREADS:
+        return c.threads;
+    case SEARCH_OPT_VERBOSE:
+        return c.verbose;
+    case SEARCH_OPT_MAX_DEPTH:
+        return c.max_depth;
+    case SEARCH_OPT_CANONICAL_KEYS:
+        return c.canonical_keys;
+    case SEARCH_OPT_PRUNE:
+        return c.prune;
+    case SEARCH_OPT_SAMPLE_EMPTY:
+        return c.sample_empty;
+    case SEARCH_OPT_SAMPLE_CELLS:
+        return c.sample_cells;
+    case SEARCH_OPT_ENGINE:
+        return c.engine;
+    case SEARCH_OPT_MCTS_PLAYOUTS:
+        return c.mcts_playouts;
+    case SEARCH_OPT_MCTS_POLICY:
+        return c.mcts_policy;
+    case SEARCH_OPT_HUGE_PAGES:
+        return c.huge_pages;
+    default:
+        return -1;
+    }
+}
+
+void get_default_heur_weights(heur_weights_t *weights) {
+    *weights = DEFAULT_HEUR_WEIGHTS;
+}
+
+static void set_evaluator(search_context &ctx, evaluator *eval, int eval_type) {
+    delete ctx.eval;
+    ctx.eval = eval;
+    ctx.eval_type = eval_type;
+    // the stored results were scored by the old evaluator
+    reset_search_context(&ctx);
+}
+
+void set_heur_weights(search_context_t *ctx, const heur_weights_t *weights) {
+    search_context &c = ctx ? *ctx : default_search_context();
+    c.heur_weights = weights ? *weights : DEFAULT_HEUR_WEIGHTS;
+    // the built-in weights keep using the built-in tables
+    evaluator *eval = NULL;
+    if (memcmp(&c.heur_weights, &DEFAULT_HEUR_WEIGHTS, sizeof(c.heur_weights)))
+        eval = new heur_table(c.heur_weights);
+    set_evaluator(c, eval, EVALUATOR_HEURISTIC);
+}
+
+void get_heur_weights(search_context_t *ctx, heur_weights_t *weights) {
+    search_context &c = ctx ? *ctx : default_search_context();
+    *weights = c.heur_weights;
+}
+
+int set_ntuple_network(search_context_t *ctx, const char *path) {
+    search_context &c = ctx ? *ctx : default_search_context();
+    if (!path) {
+        set_heur_weights(&c, &c.heur_weights);
+        return 0;
+    }
+    ntuple_network *net = ntuple_network::load(path);
+    if (!net)
+        return -1;
+    set_evaluator(c, new ntuple_evaluator(net), EVALUATOR_NTUPLE);
+    return 0;
+}
+
+uint64_t get_huge_page_bytes(search_context_t *ctx) {
+    search_context &c = ctx ? *ctx : default_search_context();
+    uint64_t bytes = c.trans_table.huge_bytes();
+    if (c.mcts)
+        bytes += c.mcts->huge_bytes();
+    if (table_memory)
+        bytes += table_memory->huge_bytes();
+    return bytes;
+}
+
+int get_evaluator(search_context_t *ctx) {
+    search_context &c = ctx ? *ctx : default_search_context();
+    return c.eval_type;
+}
+
+int set_move_cache(search_context_t *ctx, const char *path) {
+    search_context &c = ctx ? *ctx : default_search_context();
+    move_cache *cache = NULL;
+    if (path && !(cache = move_cache::load(path)))
+        return -1;
+    delete c.cache;
+    c.cache = cache;
+    return 0;
+}
+
+/* Entries stored while searching earlier roots become stale once the root changes. */
+static void begin_search(search_context &ctx, board_t board) {
+    if (board != ctx.root_board) {
+        ctx.trans_table.new_generation();
+        ctx.root_board = board;
+    }
+}
+
+struct toplevel_task {
     eval_state state;
-    state.depth_limit = std::max(3, count_distinct_tiles(board) - 2);
+    board_t board;
+    int move;
+    float alpha; // score to beat, when the other root moves are searched first
+    float result;
+    float score; // result without the 1e-6 that marks a legal move, in alpha's units
+    bool upper_bound; // the move was pruned: result only bounds its score, and it is no better than alpha
+    double elapsed;
+
+    toplevel_task(search_context &ctx, board_t board, int move) : state(ctx.trans_table), board(board), move(move), alpha(-INFINITY), result(0), score(0), upper_bound(false), elapsed(0) {
+        state.depth_limit = std::max(3, count_distinct_tiles(board) - 2);
+        if (ctx.max_depth)
+            state.depth_limit = std::min(state.depth_limit, ctx.max_depth);
+        state.canonical_keys = ctx.canonical_keys;
+        state.prune = ctx.prune;
+        state.sample_empty = ctx.sample_empty;
+        state.sample_cells = ctx.sample_cells;
+        state.eval = ctx.eval;
+        if (ctx.threads > 1) {
+            thread_pool::instance().reserve(ctx.threads);
+            state.pool = &thread_pool::instance();
+        }
+    }
+};
+
+static void run_toplevel_task(void *arg) {
+    toplevel_task *task = (toplevel_task *)arg;
+    struct timeval start, finish;
 
     gettimeofday(&start, NULL);
-    res = _score_toplevel_move(state, board, move);
+    task->result = _score_toplevel_move(task->state, task->board, task->move, task->alpha, &task->score, &task->upper_bound);
     gettimeofday(&finish, NULL);
 
-    elapsed = (finish.tv_sec - start.tv_sec);
-    elapsed += (finish.tv_usec - start.tv_usec) / 1000000.0;
+    task->elapsed = (finish.tv_sec - start.tv_sec);
+    task->elapsed += (finish.tv_usec - start.tv_usec) / 1000000.0;
+}
 
-    printf("Move %d: result %f: eval'd %ld moves (%d cache hits, %d cache size) in %.2f seconds (maxdepth=%d)\n", move, res,
-        state.moves_evaled, state.cachehits, (int)state.trans_table.size(), elapsed, state.maxdepth);
+static void report_toplevel_task(search_context &ctx, const toplevel_task &task) {
+    // a root move pruned against a better one only reports that it is no better
+    const char *bound = task.upper_bound ? "<= " : "";
+    printf("Move %d: result %s%f: eval'd %ld moves (%ld cache hits, %d cache size) in %.2f seconds (maxdepth=%d)\n", task.move, bound, task.result,
+        task.state.moves_evaled, task.state.cachehits, (int)ctx.trans_table.size(), task.elapsed, task.state.maxdepth);
+}
 
-    return res;
+float score_toplevel_move_ctx(search_context_t *ctx, board_t board, int move) {
+    return score_toplevel_move_stats(ctx, board, move, NULL);
 }
 
-/* Find the best move for a given board. */
-int find_best_move(board_t board) {
-    int move;
+float score_toplevel_move(board_t board, int move) {
+    return score_toplevel_move_ctx(&default_search_context(), board, move);
+}
+
+/* Search the root moves in the given order: concurrently if the context has threads, with
+ * each of them splitting further below. */
+static void run_toplevel_tasks_serial(std::vector<toplevel_task> &tasks, const int *order) {
+    float best = 0;
+    int bestmove = 4;
+    for (int i = 0; i < 4; i++) {
+        toplevel_task &task = tasks[order[i]];
+        // best_scored_move breaks ties toward the lower move, so such a move is only pruned if
+        // it is strictly worse, and the move is the one the full search would choose
+        if (task.state.prune)
+            task.alpha = task.move < bestmove ? nextafterf(best, -INFINITY) : best;
+        run_toplevel_task(&task);
+        if (!task.upper_bound && task.result > 0 && (task.score > best || (task.score == best && task.move < bestmove))) {
+            best = task.score;
+            bestmove = task.move;
+        }
+    }
+}
+
+static void run_toplevel_tasks(search_context &ctx, std::vector<toplevel_task> &tasks, const int *order) {
+    if (ctx.threads > 1) {
+        task_group group;
+        for (int i = 0; i < 4; i++)
+            thread_pool::instance().spawn(group, run_toplevel_task, &tasks[order[i]]);
+        thread_pool::instance().wait(group);
+    } else {
+        run_toplevel_tasks_serial(tasks, order);
+    }
+}
+
+static void add_toplevel_stats(search_context &ctx, const std::vector<toplevel_task> &tasks, search_stats_t *stats) {
+    for (size_t i = 0; i < tasks.size(); i++) {
+        const eval_state &state = tasks[i].state;
+        stats->moves_evaled += state.moves_evaled;
+        stats->tt_probes += state.cacheprobes;
+        stats->tt_hits += state.cachehits;
+        stats->maxdepth = std::max(stats->maxdepth, state.maxdepth);
+        stats->tt_stores += state.tt_stores;
+        stats->tt_overwrites += state.tt_overwrites;
+        stats->leaf_evals += state.leaf_evals;
+        stats->prob_cutoffs += state.prob_cutoffs;
+        stats->depth_cutoffs += state.depth_cutoffs;
+        stats->prune_cutoffs += state.prune_cutoffs;
+        stats->sampled_nodes += state.sampled_nodes;
+        for (int d = 0; d < SEARCH_STATS_MAX_DEPTH; d++)
+            stats->nodes_by_depth[d] += state.nodes_by_depth[d];
+    }
+    stats->tt_entries = ctx.trans_table.size();
+    stats->huge_pages = ctx.trans_table.pages();
+    stats->table_huge_pages = tables.pages;
+}
+
+// results of a finished search; those of an unfinished one may be missing parts of their trees
+static void set_move_scores(const std::vector<toplevel_task> &tasks, search_stats_t *stats) {
+    stats->move_score_bounds = 0;
+    for (size_t i = 0; i < tasks.size(); i++) {
+        stats->move_scores[tasks[i].move] = tasks[i].result;
+        if (tasks[i].upper_bound)
+            stats->move_score_bounds |= 1 << tasks[i].move;
+    }
+}
+
+/* Wall and CPU time of a search, for its stats. */
+struct search_timer {
+    std::chrono::steady_clock::time_point wall_start;
+    clock_t cpu_start;
+
+    search_timer() : wall_start(std::chrono::steady_clock::now()), cpu_start(clock()) {
+    }
+
+    void finish(search_stats_t *stats) const {
+        if (!stats)
+            return;
+        std::chrono::duration<double> wall = std::chrono::steady_clock::now() - wall_start;
+        stats->wall_time = wall.count();
+        stats->cpu_time = double(clock() - cpu_start) / CLOCKS_PER_SEC;
+    }
+};
+
+/* Score one root move, as one of the tasks of find_best_move_stats. */
+float score_toplevel_move_stats(search_context_t *ctx, board_t board, int move, search_stats_t *stats) {
+    search_timer timer;
+    std::vector<toplevel_task> tasks(1, toplevel_task(*ctx, board, move));
+
+    begin_search(*ctx, board);
+    run_toplevel_task(&tasks[0]);
+    if (ctx->verbose)
+        report_toplevel_task(*ctx, tasks[0]);
+    if (stats) {
+        memset(stats, 0, sizeof(*stats));
+        add_toplevel_stats(*ctx, tasks, stats);
+        set_move_scores(tasks, stats);
+        stats->completed_depth = tasks[0].state.depth_limit;
+        timer.finish(stats);
+    }
+
+    return tasks[0].result;
+}
+
+// the move with the highest score, or -1 if no move scores above 0
+static int best_scored_move(const float scores[4]) {
     float best = 0;
     int bestmove = -1;
+    for (int move = 0; move < 4; move++) {
+        if (scores[move] > best) {
+            best = scores[move];
+            bestmove = move;
+        }
+    }
+    return bestmove;
+}
 
+/* Answer from the context's move cache, if it has the board. */
+static bool find_cached_move(search_context &ctx, board_t board, search_stats_t *stats, int &move) {
+    const move_cache_entry *entry = ctx.cache ? ctx.cache->lookup(board) : NULL;
+    if (!entry)
+        return false;
+    if (ctx.verbose) {
+        for (int m = 0; m < 4; m++)
+            printf("Move %d: result %f (move cache)\n", m, entry->scores[m]);
+    }
+    if (stats) {
+        memset(stats, 0, sizeof(*stats));
+        stats->move_cache_hit = 1;
+        memcpy(stats->move_scores, entry->scores, sizeof(stats->move_scores));
+    }
+    move = best_scored_move(entry->scores);
+    return true;
+}
+
+/* A pruned move's bound can round to the best score, so only exact results compete: a bound
+ * never beats the move it was pruned against. */
+static int best_toplevel_move(const std::vector<toplevel_task> &tasks) {
+    float scores[4];
+    for (int move = 0; move < 4; move++)
+        scores[move] = tasks[move].upper_bound ? 0 : tasks[move].result;
+    return best_scored_move(scores);
+}
+
+static void print_search_board(const search_context &ctx, board_t board) {
+    float heur = ctx.eval ? ctx.eval->evaluate(board) : score_heur_board(board);
     print_board(board);
-    printf("Current scores: heur %.0f, actual %.0f\n", score_heur_board(board), score_board(board));
+    printf("Current scores: heur %.0f, actual %.0f\n", heur, score_board(board));
+}
 
-    for(move=0; move<4; move++) {
-        float res = score_toplevel_move(board, move);
+// the MCTS engine (see below)
+static int mcts_find_best_move(search_context &ctx, board_t board, search_limit &limit, search_stats_t *stats, async_search *progress, const search_timer &timer);
 
-        if(res > best) {
-            best = res;
-            bestmove = move;
+/* Find the best move for a given board. */
+int find_best_move_stats(search_context_t *ctx, board_t board, search_stats_t *stats) {
+    static const int order[4] = {0, 1, 2, 3};
+    search_timer timer;
+
+    if (ctx->verbose)
+        print_search_board(*ctx, board);
+
+    int cached;
+    if (find_cached_move(*ctx, board, stats, cached)) {
+        timer.finish(stats);
+        return cached;
+    }
+
+    if (ctx->engine == SEARCH_ENGINE_MCTS) {
+        search_limit limit;
+        limit.node_budget = ctx->mcts_playouts;
+        return mcts_find_best_move(*ctx, board, limit, stats, NULL, timer);
+    }
+
+    begin_search(*ctx, board);
+
+    std::vector<toplevel_task> tasks;
+    for (int move = 0; move < 4; move++)
+        tasks.push_back(toplevel_task(*ctx, board, move));
+    run_toplevel_tasks(*ctx, tasks, order);
+
+    if (ctx->verbose) {
+        for (int move = 0; move < 4; move++)
+            report_toplevel_task(*ctx, tasks[move]);
+    }
+    if (stats) {
+        memset(stats, 0, sizeof(*stats));
+        add_toplevel_stats(*ctx, tasks, stats);
+        set_move_scores(tasks, stats);
+        stats->completed_depth = tasks[0].state.depth_limit;
+        timer.finish(stats);
+    }
+
+    return best_toplevel_move(tasks);
+}
+
+// deepest iteration of find_best_move_timed when neither the context nor the budget stops it sooner
+static const int MAX_ITERATIVE_DEPTH = CACHE_DEPTH_LIMIT;
+
+/* A search running on its own thread (see start_search). */
+struct async_search {
+    search_context *ctx;
+    board_t board;
+    search_limit limit;
+    search_stats_t stats;
+    std::atomic<int> progress; // depth * 8 + best move + 1 of the deepest iteration finished so far, read as one
+    std::atomic<bool> done;
+    int result;
+    std::thread thread;
+
+    async_search(search_context *ctx, board_t board) : ctx(ctx), board(board), progress(0), done(false), result(-1) {
+    }
+};
+
+/* Monte Carlo tree search (SEARCH_ENGINE_MCTS; the tree is described in mcts.h).
+ *
+ * A playout walks down from the root. At a position it takes the move with the best UCB1
+ * score, and after the move it places a random tile as the game would, going on to the
+ * position that leads to if the tree has it. The first position it reaches that is not in
+ * the tree is added to it, and the game is played out from there to its end by the
+ * playout policy; the score gained since the root is the playout's result, and goes to
+ * every node on the way down. A position gets its afterstates on the second visit.
+ *
+ * Every thread of the search runs playouts in the same tree. A playout counts its visits
+ * on the way down, before its result is known, so the nodes other threads are working in
+ * look worse until they finish (a virtual loss), which spreads the threads over the tree.
+ * The move played is the one with the most playouts.
+ */
+
+static board_t draw_tile(rng_t *rng);
+static board_t insert_tile_rand(rng_t *rng, board_t board, board_t tile);
+
+// nodes in a context's pool (40 MB)
+static const uint32_t MCTS_POOL_NODES = 1 << 20;
+static_assert(sizeof(mcts_node) == 40, "update the pool size above");
+// UCB1 exploration weight, relative to the mean result of the parent
+static const double MCTS_EXPLORATION = 0.5;
+// playouts a thread runs between two looks at the clock, and between progress reports
+static const unsigned MCTS_CHECK_INTERVAL = 64;
+
+struct mcts_search {
+    const search_context *ctx;
+    mcts_tree *tree;
+    uint32_t root;
+    float root_score;
+    search_limit *limit;
+    async_search *progress;
+};
+
+struct mcts_worker {
+    mcts_search *search;
+    int index;
+    rng_t rng;
+    std::vector<uint32_t> path; // nodes the current playout went through
+    uint64_t playouts;
+    uint64_t moves; // made in the tree and in playouts
+    uint64_t leaf_evals;
+    int maxdepth;
+};
+
+// the legal move with the best UCB1 score, or the first one not tried yet
+static int mcts_select(mcts_tree &tree, const mcts_node &node, uint32_t first) {
+    uint32_t visits = node.visits.load(std::memory_order_relaxed);
+    double parent_mean = double(node.total.load(std::memory_order_relaxed)) / std::max(visits, 1u);
+    double exploration = MCTS_EXPLORATION * std::max(parent_mean, 1.0);
+    double log_visits = log(double(std::max(visits, 1u)));
+    int best = -1;
+    double best_value = 0;
+    for (int move = 0; move < 4; move++) {
+        if (!((node.legal >> move) & 1))
+            continue;
+        const mcts_node &child = tree[first + move];
+        uint32_t n = child.visits.load(std::memory_order_relaxed);
+        if (!n)
+            return move;
+        double value = double(child.total.load(std::memory_order_relaxed)) / n + exploration * sqrt(log_visits / n);
+        if (best < 0 || value > best_value) {
+            best = move;
+            best_value = value;
         }
     }
+    return best;
+}
+
+// the position after `afterstate` with the given board, if the tree has it
+static uint32_t mcts_find_child(mcts_tree &tree, uint32_t index, board_t board) {
+    while (index && tree[index].board != board)
+        index = tree[index].next.load(std::memory_order_acquire);
+    return index;
+}
+
+// play the game out from `board`; returns the final position
+static board_t mcts_playout(mcts_worker &w, board_t board) {
+    const search_context &ctx = *w.search->ctx;
+    board_t newboards[4];
+    while (true) {
+        int legal = expand_moves_scalar(board, newboards);
+        if (!legal)
+            return board;
+        int move = 0;
+        if (ctx.mcts_policy == MCTS_PLAYOUT_GREEDY) {
+            float best = -INFINITY;
+            for (int m = 0; m < 4; m++) {
+                if (!((legal >> m) & 1))
+                    continue;
+                float score = ctx.eval ? ctx.eval->evaluate(newboards[m]) : score_heur_board(newboards[m]);
+                w.leaf_evals++;
+                if (score > best) {
+                    best = score;
+                    move = m;
+                }
+            }
+        } else {
+            int nlegal = (legal & 1) + ((legal >> 1) & 1) + ((legal >> 2) & 1) + ((legal >> 3) & 1);
+            int pick = rng_uniform(&w.rng, nlegal);
+            for (move = 0; !((legal >> move) & 1) || pick--; move++)
+                ;
+        }
+        board = insert_tile_rand(&w.rng, newboards[move], draw_tile(&w.rng));
+        w.moves++;
+    }
+}
+
+/* One playout: down the tree, adding a node, then out to the end of the game. */
+static void mcts_run_playout(mcts_worker &w) {
+    mcts_tree &tree = *w.search->tree;
+    board_t newboards[4];
+    uint32_t index = w.search->root;
+    board_t board = tree[index].board;
+    int depth = 0;
+
+    w.path.clear();
+    tree[index].visits.fetch_add(1, std::memory_order_relaxed);
+    w.path.push_back(index);
+    while (tree[index].legal) {
+        mcts_node &node = tree[index];
+        uint32_t first = node.children.load(std::memory_order_acquire);
+        if (!first) {
+            // second visit: add the afterstates, unless another thread just did
+            if (node.visits.load(std::memory_order_relaxed) < 2 || !(first = tree.alloc(4)))
+                break;
+            expand_moves_scalar(node.board, newboards);
+            for (int move = 0; move < 4; move++)
+                tree[first + move].board = newboards[move];
+            uint32_t expected = 0;
+            if (!node.children.compare_exchange_strong(expected, first, std::memory_order_acq_rel))
+                first = expected;
+        }
 
+        uint32_t after_index = first + mcts_select(tree, node, first);
+        mcts_node &after = tree[after_index];
+        after.visits.fetch_add(1, std::memory_order_relaxed);
+        w.path.push_back(after_index);
+        board = insert_tile_rand(&w.rng, after.board, draw_tile(&w.rng));
+        w.moves++;
+        depth++;
+
+        uint32_t head = after.children.load(std::memory_order_acquire);
+        uint32_t child = mcts_find_child(tree, head, board);
+        bool added = false;
+        if (!child && (child = tree.alloc(1))) {
+            tree[child].board = board;
+            tree[child].legal = expand_moves_scalar(board, newboards);
+            while (true) {
+                tree[child].next.store(head, std::memory_order_relaxed);
+                if (after.children.compare_exchange_weak(head, child, std::memory_order_acq_rel)) {
+                    added = true;
+                    break;
+                }
+                // another position went in first; it may be this one
+                uint32_t other = mcts_find_child(tree, head, board);
+                if (other) {
+                    child = other;
+                    break;
+                }
+            }
+        }
+        if (!child)
+            break; // the pool is full: play out from the position after the tile
+        tree[child].visits.fetch_add(1, std::memory_order_relaxed);
+        w.path.push_back(child);
+        index = child;
+        if (added)
+            break;
+    }
+    w.maxdepth = std::max(w.maxdepth, depth);
+
+    board_t final_board = mcts_playout(w, board);
+    uint64_t result = (uint64_t)std::max(0.0f, score_board(final_board) - w.search->root_score);
+    for (size_t i = 0; i < w.path.size(); i++)
+        tree[w.path[i]].total.fetch_add(result, std::memory_order_relaxed);
+    w.playouts++;
+}
+
+// the root move with the most playouts (the best mean among equals), or -1 if none is legal
+static int mcts_best_move(mcts_tree &tree, uint32_t root) {
+    const mcts_node &node = tree[root];
+    uint32_t first = node.children.load(std::memory_order_acquire);
+    if (!node.legal)
+        return -1;
+    int best = -1;
+    uint32_t best_visits = 0;
+    uint64_t best_total = 0;
+    for (int move = 0; move < 4; move++) {
+        if (!((node.legal >> move) & 1))
+            continue;
+        uint32_t visits = first ? tree[first + move].visits.load(std::memory_order_relaxed) : 0;
+        uint64_t total = first ? tree[first + move].total.load(std::memory_order_relaxed) : 0;
+        // compare total / visits without dividing
+        if (best < 0 || visits > best_visits || (visits == best_visits && total > best_total)) {
+            best = move;
+            best_visits = visits;
+            best_total = total;
+        }
+    }
+    return best;
+}
+
+static void run_mcts_worker(void *arg) {
+    mcts_worker &w = *(mcts_worker *)arg;
+    search_limit &limit = *w.search->limit;
+    for (unsigned long n = 1; !limit.stop.load(std::memory_order_relaxed); n++) {
+        if (limit.node_budget && limit.nodes.fetch_add(1, std::memory_order_relaxed) >= limit.node_budget)
+            break;
+        mcts_run_playout(w);
+        if (n % MCTS_CHECK_INTERVAL == 0) {
+            if (limit.has_deadline && std::chrono::steady_clock::now() >= limit.deadline) {
+                limit.stop.store(true, std::memory_order_relaxed);
+                break;
+            }
+            if (w.search->progress && w.index == 0)
+                w.search->progress->progress = std::max(w.maxdepth, 1) * 8 + mcts_best_move(*w.search->tree, w.search->root) + 1;
+        }
+    }
+}
+
+/* Search with the MCTS engine until the limit stops it (see iterative_search for `progress`). */
+static int mcts_find_best_move(search_context &ctx, board_t board, search_limit &limit, search_stats_t *stats, async_search *progress, const search_timer &timer) {
+    if (!ctx.mcts)
+        ctx.mcts = new mcts_tree(MCTS_POOL_NODES, ctx.huge_pages);
+    mcts_tree &tree = *ctx.mcts;
+    board_t newboards[4];
+
+    mcts_search search;
+    search.ctx = &ctx;
+    search.tree = &tree;
+    tree.clear();
+    search.root = tree.alloc(1);
+    tree[search.root].board = board;
+    tree[search.root].legal = expand_moves_scalar(board, newboards);
+    search.root_score = score_board(board);
+    search.limit = &limit;
+    search.progress = progress;
+
+    int nworkers = tree[search.root].legal ? ctx.threads : 0;
+    std::vector<mcts_worker> workers(nworkers);
+    for (int i = 0; i < nworkers; i++) {
+        workers[i].search = &search;
+        workers[i].index = i;
+        rng_seed(&workers[i].rng, trans_table_hash(board) + i);
+        workers[i].playouts = 0;
+        workers[i].moves = 0;
+        workers[i].leaf_evals = 0;
+        workers[i].maxdepth = 0;
+    }
+    if (nworkers > 1) {
+        thread_pool::instance().reserve(nworkers);
+        task_group group;
+        for (int i = 0; i < nworkers; i++)
+            thread_pool::instance().spawn(group, run_mcts_worker, &workers[i]);
+        thread_pool::instance().wait(group);
+    } else if (nworkers == 1) {
+        run_mcts_worker(&workers[0]);
+    }
+
+    int bestmove = mcts_best_move(tree, search.root);
+    int maxdepth = 0;
+    for (int i = 0; i < nworkers; i++)
+        maxdepth = std::max(maxdepth, workers[i].maxdepth);
+    if (progress)
+        progress->progress = std::max(maxdepth, 1) * 8 + bestmove + 1;
+
+    float scores[4] = {0, 0, 0, 0};
+    uint32_t visits[4] = {0, 0, 0, 0};
+    uint32_t first = tree[search.root].children.load(std::memory_order_acquire);
+    for (int move = 0; first && move < 4; move++) {
+        visits[move] = tree[first + move].visits;
+        if (((tree[search.root].legal >> move) & 1) && visits[move])
+            scores[move] = search.root_score + float(tree[first + move].total) / visits[move];
+    }
+    if (ctx.verbose) {
+        for (int move = 0; move < 4; move++)
+            printf("Move %d: result %f: %u playouts\n", move, scores[move], visits[move]);
+        printf("MCTS: %u playouts, %u nodes, depth %d\n", tree[search.root].visits.load(), tree.size(), maxdepth);
+    }
+    if (stats) {
+        memset(stats, 0, sizeof(*stats));
+        for (int i = 0; i < nworkers; i++) {
+            stats->playouts += workers[i].playouts;
+            stats->moves_evaled += workers[i].moves;
+            stats->leaf_evals += workers[i].leaf_evals;
+        }
+        stats->maxdepth = maxdepth;
+        stats->completed_depth = maxdepth;
+        stats->tree_nodes = tree.size();
+        stats->huge_pages = tree.pages();
+        stats->table_huge_pages = tables.pages;
+        memcpy(stats->move_scores, scores, sizeof(scores));
+        timer.finish(stats);
+    }
     return bestmove;
 }
 
+/* Anytime search: iterations of depth 1, 2, 3... share the transposition table, so each
+ * one starts from the entries of the previous one, and its root moves are taken in order
+ * of the previous scores. The search stops when the limit stops it, when an iteration
+ * found no leaf at its depth limit (the probability cutoff bounds the whole tree, so going
+ * deeper changes nothing), or at the context's depth cap. The move comes from the last
+ * iteration that finished, and is also published to `progress` (if not NULL) as soon as
+ * that iteration finishes. */
+static int iterative_search(search_context &ctx, board_t board, search_limit &limit, search_stats_t *stats, async_search *progress) {
+    search_timer timer;
+
+    if (ctx.verbose)
+        print_search_board(ctx, board);
+
+    int cached;
+    if (find_cached_move(ctx, board, stats, cached)) {
+        timer.finish(stats);
+        if (progress)
+            progress->progress = cached + 1;
+        return cached;
+    }
+
+    if (ctx.engine == SEARCH_ENGINE_MCTS) {
+        if (!limit.has_deadline && !limit.node_budget)
+            limit.node_budget = ctx.mcts_playouts;
+        return mcts_find_best_move(ctx, board, limit, stats, progress, timer);
+    }
+
+    begin_search(ctx, board);
+
+    if (stats)
+        memset(stats, 0, sizeof(*stats));
+
+    int order[4] = {0, 1, 2, 3};
+    int bestmove = -1;
+    int max_depth = ctx.max_depth ? std::min(ctx.max_depth, MAX_ITERATIVE_DEPTH) : MAX_ITERATIVE_DEPTH;
+    for (int depth = 1; depth <= max_depth; depth++) {
+        std::vector<toplevel_task> tasks;
+        for (int move = 0; move < 4; move++) {
+            tasks.push_back(toplevel_task(ctx, board, move));
+            tasks[move].state.depth_limit = depth;
+            // the first iteration is tiny and always completes, so there is always a move
+            if (depth > 1)
+                tasks[move].state.limit = &limit;
+        }
+        run_toplevel_tasks(ctx, tasks, order);
+
+        if (stats)
+            add_toplevel_stats(ctx, tasks, stats);
+        if (limit.stop.load(std::memory_order_relaxed))
+            break;
+
+        bestmove = best_toplevel_move(tasks);
+        if (stats) {
+            set_move_scores(tasks, stats);
+            stats->completed_depth = depth;
+        }
+        if (progress)
+            progress->progress = depth * 8 + bestmove + 1;
+        if (ctx.verbose) {
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - timer.wall_start;
+            printf("Depth %d: best move %d, scores %f %f %f %f, %.2f ms\n", depth, bestmove,
+                tasks[0].result, tasks[1].result, tasks[2].result, tasks[3].result, elapsed.count() * 1000);
+        }
+
+        // the best move first, even if a pruned move's bound rounded to its score
+        std::sort(order, order + 4, [&tasks](int a, int b) {
+            if (tasks[a].upper_bound != tasks[b].upper_bound)
+                return tasks[b].upper_bound;
+            return tasks[a].result > tasks[b].result;
+        });
+
+        bool reached_limit = false;
+        for (int move = 0; move < 4; move++)
+            reached_limit |= tasks[move].state.reached_limit;
+        if (bestmove < 0 || !reached_limit)
+            break;
+    }
+    timer.finish(stats);
+
+    return bestmove;
+}
+
+int find_best_move_timed(search_context_t *ctx, board_t board, unsigned budget_ms, uint64_t node_budget, search_stats_t *stats) {
+    search_limit limit;
+    if (budget_ms) {
+        limit.has_deadline = true;
+        limit.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(budget_ms);
+    }
+    limit.node_budget = node_budget;
+    return iterative_search(*ctx, board, limit, stats, NULL);
+}
+
+static void run_async_search(async_search *search) {
+    search->result = iterative_search(*search->ctx, search->board, search->limit, &search->stats, search);
+    search->done = true;
+}
+
+async_search_t *start_search(search_context_t *ctx, board_t board, unsigned budget_ms, uint64_t node_budget) {
+    async_search *search = new async_search(ctx, board);
+    if (budget_ms) {
+        search->limit.has_deadline = true;
+        search->limit.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(budget_ms);
+    }
+    search->limit.node_budget = node_budget;
+    search->thread = std::thread(run_async_search, search);
+    return search;
+}
+
+int poll_search(async_search_t *search, int *move, int *depth) {
+    // read done first: a finished search has published its last move before setting it
+    bool done = search->done;
+    int progress = search->progress;
+    if (move)
+        *move = progress % 8 - 1;
+    if (depth)
+        *depth = progress / 8;
+    return done;
+}
+
+void cancel_search(async_search_t *search) {
+    search->limit.stop = true;
+}
+
+int finish_search(async_search_t *search, search_stats_t *stats) {
+    search->thread.join();
+    int move = search->result;
+    if (stats)
+        *stats = search->stats;
+    delete search;
+    return move;
+}
+
+struct batch_search {
+    search_context *ctx;
+    const board_t *boards;
+    size_t n;
+    int *moves;
+    float *scores;
+    std::atomic<size_t> next; // next board to search
+};
+
+/* Search one board of a batch on the calling thread. */
+static void search_batch_board(search_context &ctx, board_t board, int *move, float *scores) {
+    static const int order[4] = {0, 1, 2, 3};
+    float result[4];
+
+    const move_cache_entry *entry = ctx.cache ? ctx.cache->lookup(board) : NULL;
+    if (entry) {
+        memcpy(result, entry->scores, sizeof(result));
+    } else {
+        std::vector<toplevel_task> tasks;
+        for (int m = 0; m < 4; m++) {
+            tasks.push_back(toplevel_task(ctx, board, m));
+            tasks[m].state.pool = NULL;
+        }
+        if (scores) {
+            // exact scores for every move, as score_toplevel_move gives them
+            for (int m = 0; m < 4; m++)
+                run_toplevel_task(&tasks[m]);
+        } else {
+            run_toplevel_tasks_serial(tasks, order);
+        }
+        for (int m = 0; m < 4; m++)
+            result[m] = tasks[m].upper_bound ? 0 : tasks[m].result;
+    }
+
+    *move = best_scored_move(result);
+    if (scores)
+        memcpy(scores, result, sizeof(result));
+}
+
+static void run_batch_search(void *arg) {
+    batch_search *batch = (batch_search *)arg;
+    while (true) {
+        size_t i = batch->next++;
+        if (i >= batch->n)
+            break;
+        search_batch_board(*batch->ctx, batch->boards[i], &batch->moves[i], batch->scores ? &batch->scores[4 * i] : NULL);
+    }
+}
+
+void find_best_moves_batch(search_context_t *ctx, const board_t *boards, size_t n, int *moves, float *scores) {
+    batch_search batch;
+    batch.ctx = ctx;
+    batch.boards = boards;
+    batch.n = n;
+    batch.moves = moves;
+    batch.scores = scores;
+    batch.next = 0;
+
+    // the boards share the table, but none of them is the root the next search continues from
+    ctx->trans_table.new_generation();
+    ctx->root_board = 0;
+
+    size_t nthreads = std::min<size_t>(ctx->threads, n);
+    if (nthreads > 1) {
+        thread_pool &pool = thread_pool::instance();
+        pool.reserve(nthreads);
+        task_group group;
+        for (size_t i = 0; i < nthreads; i++)
+            pool.spawn(group, run_batch_search, &batch);
+        pool.wait(group);
+    } else {
+        run_batch_search(&batch);
+    }
+}
+
+int find_best_move_ctx(search_context_t *ctx, board_t board) {
+    return find_best_move_stats(ctx, board, NULL);
+}
+
+int find_best_move(board_t board) {
+    return find_best_move_ctx(&default_search_context(), board);
+}
+
 int ask_for_move(board_t board) {
     int move;
     char validstr[5];
@@ -460,12 +2010,12 @@ int ask_for_move(board_t board) {
 }
 
 /* Playing the game */
-static board_t draw_tile() {
-    return (unif_random(10) < 9) ? 1 : 2;
+static board_t draw_tile(rng_t *rng) {
+    return (rng_uniform(rng, 10) < 9) ? 1 : 2;
 }
 
-static board_t insert_tile_rand(board_t board, board_t tile) {
-    int index = unif_random(count_empty(board));
+static board_t insert_tile_rand(rng_t *rng, board_t board, board_t tile) {
+    int index = rng_uniform(rng, count_empty(board));
     board_t tmp = board;
     while (true) {
         while ((tmp & 0xf) != 0) {
@@ -480,13 +2030,16 @@ static board_t insert_tile_rand(board_t board, board_t tile) {
     return board | tile;
 }
 
-static board_t initial_board() {
-    board_t board = draw_tile() << (4 * unif_random(16));
-    return insert_tile_rand(board, draw_tile());
+static board_t initial_board(rng_t *rng) {
+    board_t board = draw_tile(rng) << (4 * rng_uniform(rng, 16));
+    return insert_tile_rand(rng, board, draw_tile(rng));
 }
 
-void play_game(get_move_func_t get_move) {
-    board_t board = initial_board();
+void play_game_seeded(uint64_t seed, get_move_user_func_t get_move, void *user, int verbose, game_result_t *result) {
+    rng_t rng;
+    rng_seed(&rng, seed);
+
+    board_t board = initial_board(&rng);
     int moveno = 0;
     int scorepenalty = 0; // "penalty" for obtaining free 4 tiles
 
@@ -501,29 +2054,49 @@ void play_game(get_move_func_t get_move) {
         if(move == 4)
             break; // no legal moves
 
-        printf("\nMove #%d, current score=%.0f\n", ++moveno, score_board(board) - scorepenalty);
+        ++moveno;
+        if (verbose)
+            printf("\nMove #%d, current score=%.0f\n", moveno, score_board(board) - scorepenalty);
 
-        move = get_move(board);
+        move = get_move(board, user);
         if(move < 0)
             break;
 
         newboard = execute_move(move, board);
         if(newboard == board) {
-            printf("Illegal move!\n");
+            if (verbose)
+                printf("Illegal move!\n");
             moveno--;
             continue;
         }
 
-        board_t tile = draw_tile();
+        board_t tile = draw_tile(&rng);
         if (tile == 2) scorepenalty += 4;
-        board = insert_tile_rand(newboard, tile);
+        board = insert_tile_rand(&rng, newboard, tile);
     }
 
-    print_board(board);
-    printf("\nGame over. Your score is %.0f. The highest rank you achieved was %d.\n", score_board(board) - scorepenalty, get_max_rank(board));
+    if (verbose) {
+        print_board(board);
+        printf("\nGame over. Your score is %.0f. The highest rank you achieved was %d.\n", score_board(board) - scorepenalty, get_max_rank(board));
+    }
+
+    if (result) {
+        result->board = board;
+        result->score = (uint32_t)(score_board(board) - scorepenalty);
+        result->maxrank = get_max_rank(board);
+        result->moves = moveno;
+    }
+}
+
+static int call_get_move(board_t board, void *user) {
+    return (*(get_move_func_t *)user)(board);
 }
 
-int main() {
-    init_tables();
-    play_game(find_best_move);
+void play_game(get_move_func_t get_move) {
+    // seed from the platform's entropy source
+    uint64_t seed = 0;
+    for (int i = 0; i < 4; i++)
+        seed = (seed << 16) | unif_random(1 << 16);
+
+    play_game_seeded(seed, call_get_move, &get_move, 1, NULL);
 }
@@ -1,3 +1,8 @@
+#ifndef GAME_2048_H
+#define GAME_2048_H
+
+#include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include "platdefs.h"
 
@@ -15,12 +20,6 @@
 typedef uint64_t board_t;
 typedef uint16_t row_t;
 
-//store the depth at which the heuristic was recorded as well as the actual heuristic
-struct trans_table_entry_t{
-    uint8_t depth;
-    float heuristic;
-};
-
 static const board_t ROW_MASK = 0xFFFFULL;
 static const board_t COL_MASK = 0x000F000F000F000FULL;
 
@@ -51,15 +50,224 @@ static inline row_t reverse_row(row_t row) {
 extern "C" {
 #endif
 
+/* The move and score tables are generated at build time, so there is nothing to set up
+ * before calling into the engine; init_tables() is kept for existing callers. */
 DLL_PUBLIC void init_tables();
 DLL_PUBLIC board_t execute_move(int move, board_t board);
 
+/* Move generation kernels. expand_moves writes the boards after each of the four moves
+ * (up, down, left, right) to out[0..3] and returns a mask with bit `move` set if that move
+ * changes the board. expand_moves_batch does the same for n boards, writing out[4*i..4*i+3]
+ * and masks[i] for boards[i]. The vectorized kernels are picked at runtime from what the CPU
+ * supports; set_kernel_isa can force a lower level (e.g. for benchmarking) and returns the
+ * level actually in use. */
+enum {
+    KERNEL_ISA_SCALAR = 0,
+    KERNEL_ISA_AVX2 = 1,
+};
+DLL_PUBLIC int expand_moves(board_t board, board_t *out);
+DLL_PUBLIC void expand_moves_batch(const board_t *boards, size_t n, board_t *out, uint8_t *masks);
+DLL_PUBLIC int get_kernel_isa(void);
+
+/* Leaf evaluation: out[i] = the heuristic score of boards[i], using the vectorized kernel when available. */
+DLL_PUBLIC void score_heur_boards(const board_t *boards, size_t n, float *out);
+DLL_PUBLIC int set_kernel_isa(int isa);
+
 typedef int (*get_move_func_t)(board_t);
+typedef int (*get_move_user_func_t)(board_t board, void *user);
 DLL_PUBLIC float score_toplevel_move(board_t board, int move);
 DLL_PUBLIC int find_best_move(board_t board);
 DLL_PUBLIC int ask_for_move(board_t board);
 DLL_PUBLIC void play_game(get_move_func_t get_move);
+DLL_PUBLIC void set_trans_table_size(unsigned megabytes);
+
+/* Search contexts keep the transposition table alive between searches. Hold one per game:
+ * the context-less functions above share a single process-wide context.
+ * A trans_table_mb of 0 uses the size last passed to set_trans_table_size (default 64 MB). */
+typedef struct search_context search_context_t;
+DLL_PUBLIC search_context_t *create_search_context(unsigned trans_table_mb);
+DLL_PUBLIC void reset_search_context(search_context_t *ctx);
+DLL_PUBLIC void free_search_context(search_context_t *ctx);
+DLL_PUBLIC float score_toplevel_move_ctx(search_context_t *ctx, board_t board, int move);
+DLL_PUBLIC int find_best_move_ctx(search_context_t *ctx, board_t board);
+
+/* Search options. A NULL context sets the option on the process-wide context. */
+enum {
+    SEARCH_OPT_THREADS = 0, // threads splitting each search; 0 = one per core (the default)
+    SEARCH_OPT_VERBOSE = 1, // print the board and per-move results of each search (default 0)
+    SEARCH_OPT_MAX_DEPTH = 2, // cap on the search depth; 0 = no cap (the default)
+    SEARCH_OPT_CANONICAL_KEYS = 3, // share table entries between rotations/reflections of a board (default 0)
+    SEARCH_OPT_PRUNE = 4, // skip chance nodes that provably cannot change the move chosen above them (default 1)
+    SEARCH_OPT_SAMPLE_EMPTY = 5, // on boards with more empty cells than this, only search a sample of the tile placements; 0 = never (the default)
+    SEARCH_OPT_SAMPLE_CELLS = 6, // cells in that sample, each with both tiles (default 4)
+    SEARCH_OPT_ENGINE = 7, // SEARCH_ENGINE_*: the search find_best_move* runs (default SEARCH_ENGINE_EXPECTIMAX)
+    SEARCH_OPT_MCTS_PLAYOUTS = 8, // playouts of an MCTS search that has no other budget (default 10000)
+    SEARCH_OPT_MCTS_POLICY = 9, // MCTS_PLAYOUT_*: how MCTS playouts choose their moves (default MCTS_PLAYOUT_GREEDY)
+    SEARCH_OPT_HUGE_PAGES = 10, // put the transposition table and MCTS node pool in huge pages if possible; changing it clears the table (default 0)
+};
+
+/* Search engines. SEARCH_ENGINE_EXPECTIMAX is the depth-limited expectimax search the rest
+ * of this header describes. SEARCH_ENGINE_MCTS is a Monte Carlo tree search: it grows a
+ * tree from the root by sampling tile placements, scores each new leaf by playing the game
+ * out to its end (randomly, or greedily by the context's evaluator), and plays the root move
+ * with the most playouts. It has no depth limit and can stop after any playout, so it
+ * suits strict time limits better than it does exact play. The context's threads all grow
+ * the same tree.
+ * The engine is used by find_best_move*, find_best_move_timed and start_search, where
+ * node_budget counts playouts and a search given no budget at all runs
+ * SEARCH_OPT_MCTS_PLAYOUTS of them; score_toplevel_move* and find_best_moves_batch always
+ * use expectimax. For an MCTS search, search_stats_t::move_scores holds each root move's
+ * mean playout score, and completed_depth and maxdepth the depth of the tree. */
+enum {
+    SEARCH_ENGINE_EXPECTIMAX = 0,
+    SEARCH_ENGINE_MCTS = 1,
+};
+enum {
+    MCTS_PLAYOUT_RANDOM = 0, // uniformly random legal moves
+    MCTS_PLAYOUT_GREEDY = 1, // the move whose result the evaluator scores highest
+};
+
+/* Huge pages. The transposition table and the MCTS node pool are probed at random, so
+ * with 4 KB pages most probes also miss the TLB. With SEARCH_OPT_HUGE_PAGES, a context
+ * asks for 2 MB pages for them: from the reserved huge page pool if there is one, else as
+ * transparent huge pages; where neither is available it quietly gets ordinary pages.
+ * use_huge_page_tables moves the process's move and score tables (1.75 MB, or 512 KB with
+ * COMPACT_TABLES) into a huge page of their own as well, instead of the compiled-in copy
+ * that processes share; call it before searching, as it is not safe during a search. It
+ * returns what the tables got.
+ * search_stats_t reports what each of them got as HUGE_PAGES_*. HUGE_PAGES_TRANSPARENT only
+ * says the kernel was asked; get_huge_page_bytes counts the bytes of the context's table and
+ * pool, and of the tables, that really sit in huge pages, from /proc/self/smaps on Linux (it
+ * takes milliseconds, so do not call it per move). */
+enum {
+    HUGE_PAGES_NONE = 0, // ordinary pages
+    HUGE_PAGES_TRANSPARENT = 1, // transparent huge pages requested with madvise
+    HUGE_PAGES_EXPLICIT = 2, // pages from the reserved pool (MAP_HUGETLB)
+};
+DLL_PUBLIC int use_huge_page_tables(void);
+DLL_PUBLIC uint64_t get_huge_page_bytes(search_context_t *ctx);
+DLL_PUBLIC void set_search_option(search_context_t *ctx, int option, int value);
+DLL_PUBLIC int get_search_option(search_context_t *ctx, int option);
+
+/* Heuristic weights (see row_heur_score in tables.h). A context scores boards with the
+ * built-in weights until given others: set_heur_weights rebuilds the context's heuristic
+ * table (a few milliseconds) and clears its transposition table, and NULL weights go back
+ * to the built-in ones. A NULL context sets the weights of the process-wide context. */
+typedef struct {
+    float lost_penalty; // constant added to every row, so that any board beats a lost game (scored 0)
+    float monotonicity_power;
+    float monotonicity_weight;
+    float sum_power;
+    float sum_weight;
+    float merges_weight;
+    float empty_weight;
+} heur_weights_t;
+DLL_PUBLIC void get_default_heur_weights(heur_weights_t *weights);
+DLL_PUBLIC void set_heur_weights(search_context_t *ctx, const heur_weights_t *weights);
+DLL_PUBLIC void get_heur_weights(search_context_t *ctx, heur_weights_t *weights);
+
+/* Leaf evaluators. A context scores the boards at the edge of its search with the
+ * heuristic above, or with an n-tuple network (see ntuple.h) loaded from a file with
+ * set_ntuple_network. The file is memory-mapped, so contexts and processes loading the
+ * same network share its pages. set_ntuple_network returns 0, or -1 (with the reason on
+ * stderr, and the context unchanged) if the file is not a usable network; a NULL path goes
+ * back to the heuristic. Changing the evaluator clears the transposition table, and
+ * set_heur_weights also makes the heuristic the evaluator again. */
+enum {
+    EVALUATOR_HEURISTIC = 0,
+    EVALUATOR_NTUPLE = 1,
+};
+DLL_PUBLIC int set_ntuple_network(search_context_t *ctx, const char *path);
+DLL_PUBLIC int get_evaluator(search_context_t *ctx);
+
+/* Move cache: a file of root scores for positions searched ahead of time (see move_cache.h
+ * and `bin/2048 build-move-cache`). It is memory-mapped read-only, so any number of
+ * contexts and processes can share one. A context with a cache answers find_best_move_*
+ * for the positions in it straight from the file. set_move_cache returns 0, or -1 (with the
+ * reason on stderr, and the context unchanged) if the file is not a move cache; a NULL path
+ * drops the context's cache. */
+DLL_PUBLIC int set_move_cache(search_context_t *ctx, const char *path);
+
+/* Statistics of one search, filled in by the *_stats entry points and find_best_move_timed
+ * (summed over the root moves, and over every iteration of a timed search). Searches only
+ * print what they did with SEARCH_OPT_VERBOSE set; these are the way to observe them
+ * otherwise. */
+enum { SEARCH_STATS_MAX_DEPTH = 16 };
+typedef struct {
+    uint64_t moves_evaled;
+    uint64_t tt_probes;
+    uint64_t tt_hits;
+    int maxdepth;
+    uint64_t tt_entries; // entries held by the transposition table after the search
+    int completed_depth; // depth limit of the search, or of the last finished iteration of a timed search
+    int move_cache_hit; // 1 if the move came from the context's move cache, without a search
+    uint64_t tt_stores; // results written to the transposition table
+    uint64_t tt_overwrites; // stores that evicted the entry of another board
+    uint64_t leaf_evals; // boards scored by the evaluator, including for move ordering
+    uint64_t prob_cutoffs; // chance nodes scored by the evaluator because their probability was too low
+    uint64_t depth_cutoffs; // chance nodes scored by the evaluator because they were at the depth limit
+    uint64_t prune_cutoffs; // chance nodes cut off early by pruning (SEARCH_OPT_PRUNE)
+    uint64_t nodes_by_depth[SEARCH_STATS_MAX_DEPTH]; // moves_evaled by the number of moves below the root (0 stays empty); the last entry also counts every deeper one
+    double wall_time; // seconds
+    double cpu_time; // seconds of CPU used by the whole process (all search threads) during the search
+    float move_scores[4]; // score of each root move (0 if illegal or not searched); see move_score_bounds
+    uint64_t sampled_nodes; // chance nodes that only searched a sample of their tile placements (SEARCH_OPT_SAMPLE_EMPTY)
+    uint64_t playouts; // games played out by an MCTS search
+    uint64_t tree_nodes; // nodes of an MCTS search's tree
+    int huge_pages; // HUGE_PAGES_*: pages of the transposition table (expectimax) or node pool (MCTS) the search used
+    int table_huge_pages; // HUGE_PAGES_*: pages of the move and score tables
+    int move_score_bounds; // mask of the root moves pruned against a better one (SEARCH_OPT_PRUNE): their move_scores are upper bounds, which may round to the best score, not exact scores
+} search_stats_t;
+DLL_PUBLIC int find_best_move_stats(search_context_t *ctx, board_t board, search_stats_t *stats);
+DLL_PUBLIC float score_toplevel_move_stats(search_context_t *ctx, board_t board, int move, search_stats_t *stats);
+
+/* Asynchronous search: start_search runs find_best_move_timed's iterative deepening on a
+ * thread of its own and returns at once. Budgets of 0 mean no limit, so such a search runs
+ * until its depth cap, or until the tree stops growing, unless it is canceled.
+ *   poll_search: returns 1 once the search has finished, else 0; *move and *depth
+ *     (either may be NULL) get the best move of the deepest iteration finished so far,
+ *     and its depth (-1 and 0 until the first, very short, iteration is done).
+ *   cancel_search: asks the search to stop soon, from any thread, without waiting for it.
+ *   finish_search: waits for the search to finish, frees it and returns its move, which
+ *     is what poll_search last reported; `stats` is optional.
+ * Every started search must be finished. The context is the search's until then: it must
+ * not be used or freed by anything else in the meantime, and keeps its transposition
+ * table for the next search, canceled or not. */
+typedef struct async_search async_search_t;
+DLL_PUBLIC async_search_t *start_search(search_context_t *ctx, board_t board, unsigned budget_ms, uint64_t node_budget);
+DLL_PUBLIC int poll_search(async_search_t *search, int *move, int *depth);
+DLL_PUBLIC void cancel_search(async_search_t *search);
+DLL_PUBLIC int finish_search(async_search_t *search, search_stats_t *stats);
+
+/* Batch search of n independent boards: moves[i] = the move find_best_move_ctx would pick
+ * for boards[i] (-1 if none), and, if `scores` is not NULL, scores[4*i..4*i+3] = the
+ * score_toplevel_move_ctx of each of its four moves. The batch is spread over the
+ * context's SEARCH_OPT_THREADS threads, one board per thread at a time, all sharing the
+ * context's transposition table, so a whole batch costs one call into the library instead
+ * of one per board and move. As with consecutive searches, a board may find entries left
+ * by the others in the table, so with several threads the scores can vary slightly with
+ * the order the boards are searched in. Nothing is printed, whatever SEARCH_OPT_VERBOSE
+ * says. */
+DLL_PUBLIC void find_best_moves_batch(search_context_t *ctx, const board_t *boards, size_t n, int *moves, float *scores);
+
+/* Iterative deepening under a budget of `budget_ms` milliseconds and/or `node_budget` moves
+ * evaluated (0 = no limit of that kind); returns the best move of the deepest search that
+ * finished in time. `stats` (optional) counts the work of every iteration, including the
+ * unfinished one. The context's depth cap also caps the deepening. */
+DLL_PUBLIC int find_best_move_timed(search_context_t *ctx, board_t board, unsigned budget_ms, uint64_t node_budget, search_stats_t *stats);
+
+/* Play one game whose tiles are drawn from a generator seeded with `seed`; the same seed
+ * and the same moves always give the same game. Output is only printed if verbose is set. */
+typedef struct {
+    board_t board; // final position
+    uint32_t score;
+    int maxrank;
+    int moves;
+} game_result_t;
+DLL_PUBLIC void play_game_seeded(uint64_t seed, get_move_user_func_t get_move, void *user, int verbose, game_result_t *result);
 
 #ifdef __cplusplus
 }
 #endif
+
+#endif /* GAME_2048_H */
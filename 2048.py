@@ -6,9 +6,9 @@
 from __future__ import print_function
 import time
 
-from ailib import ailib, to_c_board, from_c_index
+from ailib import ailib, SearchContext, SEARCH_OPT_THREADS, to_c_board, from_c_index
 
-# Enable multithreading?
+# Enable multithreading? The search is split across all cores inside the library.
 MULTITHREAD = True
 
 def print_board(m):
@@ -28,26 +28,9 @@ def _to_score(c):
 def to_score(m):
     return [[_to_score(c) for c in row] for row in m]
 
-if MULTITHREAD:
-    from multiprocessing.pool import ThreadPool
-    pool = ThreadPool(4)
-    def score_toplevel_move(args):
-        return ailib.score_toplevel_move(*args)
-
-    def find_best_move(m):
-        board = to_c_board(m)
-
-        print_board(to_val(m))
-
-        scores = pool.map(score_toplevel_move, [(board, move) for move in range(4)])
-        bestmove, bestscore = max(enumerate(scores), key=lambda x:x[1])
-        if bestscore == 0:
-            return -1
-        return bestmove
-else:
-    def find_best_move(m):
-        board = to_c_board(m)
-        return ailib.find_best_move(board)
+def find_best_move(m, ctx):
+    board = to_c_board(m)
+    return ailib.find_best_move_ctx(ctx.ctx, board)
 
 def movename(move):
     return ['up', 'down', 'left', 'right'][move]
@@ -55,6 +38,8 @@ def movename(move):
 def play_game(gamectrl):
     moveno = 0
     start = time.time()
+    ctx = SearchContext()
+    ctx.set_option(SEARCH_OPT_THREADS, 0 if MULTITHREAD else 1)
     while 1:
         state = gamectrl.get_status()
         if state == 'ended':
@@ -65,12 +50,13 @@ def play_game(gamectrl):
 
         moveno += 1
         board = gamectrl.get_board()
-        move = find_best_move(board)
+        move = find_best_move(board, ctx)
         if move < 0:
             break
         print("%010.6f: Score %d, Move %d: %s" % (time.time() - start, gamectrl.get_score(), moveno, movename(move)))
         gamectrl.execute_move(move)
 
+    ctx.close()
     score = gamectrl.get_score()
     board = gamectrl.get_board()
     maxval = max(max(row) for row in to_val(board))
@@ -1,3 +1,4 @@
+import array
 import ctypes
 import os
 
@@ -11,13 +12,236 @@ else:
     print("Couldn't find 2048 library bin/2048.{so,dll,dylib}! Make sure to build it first.")
     exit()
 
-ailib.init_tables()
-
 ailib.find_best_move.argtypes = [ctypes.c_uint64]
 ailib.score_toplevel_move.argtypes = [ctypes.c_uint64, ctypes.c_int]
 ailib.score_toplevel_move.restype = ctypes.c_float
 ailib.execute_move.argtypes = [ctypes.c_int, ctypes.c_uint64]
 ailib.execute_move.restype = ctypes.c_uint64
+ailib.expand_moves.argtypes = [ctypes.c_uint64, ctypes.POINTER(ctypes.c_uint64)]
+ailib.expand_moves_batch.argtypes = [ctypes.POINTER(ctypes.c_uint64), ctypes.c_size_t, ctypes.POINTER(ctypes.c_uint64), ctypes.POINTER(ctypes.c_uint8)]
+ailib.expand_moves_batch.restype = None
+ailib.score_heur_boards.argtypes = [ctypes.POINTER(ctypes.c_uint64), ctypes.c_size_t, ctypes.POINTER(ctypes.c_float)]
+ailib.score_heur_boards.restype = None
+ailib.set_kernel_isa.argtypes = [ctypes.c_int]
+ailib.set_trans_table_size.argtypes = [ctypes.c_uint]
+ailib.create_search_context.argtypes = [ctypes.c_uint]
+ailib.create_search_context.restype = ctypes.c_void_p
+ailib.reset_search_context.argtypes = [ctypes.c_void_p]
+ailib.free_search_context.argtypes = [ctypes.c_void_p]
+ailib.score_toplevel_move_ctx.argtypes = [ctypes.c_void_p, ctypes.c_uint64, ctypes.c_int]
+ailib.score_toplevel_move_ctx.restype = ctypes.c_float
+ailib.find_best_move_ctx.argtypes = [ctypes.c_void_p, ctypes.c_uint64]
+SEARCH_STATS_MAX_DEPTH = 16
+class SearchStats(ctypes.Structure):
+    _fields_ = [
+        ('moves_evaled', ctypes.c_uint64),
+        ('tt_probes', ctypes.c_uint64),
+        ('tt_hits', ctypes.c_uint64),
+        ('maxdepth', ctypes.c_int),
+        ('tt_entries', ctypes.c_uint64),
+        ('completed_depth', ctypes.c_int),
+        ('move_cache_hit', ctypes.c_int),
+        ('tt_stores', ctypes.c_uint64),
+        ('tt_overwrites', ctypes.c_uint64),
+        ('leaf_evals', ctypes.c_uint64),
+        ('prob_cutoffs', ctypes.c_uint64),
+        ('depth_cutoffs', ctypes.c_uint64),
+        ('prune_cutoffs', ctypes.c_uint64),
+        ('nodes_by_depth', ctypes.c_uint64 * SEARCH_STATS_MAX_DEPTH),
+        ('wall_time', ctypes.c_double),
+        ('cpu_time', ctypes.c_double),
+        ('move_scores', ctypes.c_float * 4),
+        ('sampled_nodes', ctypes.c_uint64),
+        ('playouts', ctypes.c_uint64),
+        ('tree_nodes', ctypes.c_uint64),
+        ('huge_pages', ctypes.c_int),
+        ('table_huge_pages', ctypes.c_int),
+        ('move_score_bounds', ctypes.c_int),
+    ]
+
+ailib.find_best_move_stats.argtypes = [ctypes.c_void_p, ctypes.c_uint64, ctypes.POINTER(SearchStats)]
+ailib.score_toplevel_move_stats.argtypes = [ctypes.c_void_p, ctypes.c_uint64, ctypes.c_int, ctypes.POINTER(SearchStats)]
+ailib.score_toplevel_move_stats.restype = ctypes.c_float
+class _ArrayArg(object):
+    ''' ctypes argument type for a C array of `ctype`. Besides None and ctypes arrays, it takes
+    NumPy arrays and any other C-contiguous buffer of the right item size (array.array,
+    bytearray, memoryview; bytes for inputs) and passes a pointer to its memory, without
+    copying it. '''
+    def __init__(self, ctype):
+        self.ctype = ctype
+        self.pointer = ctypes.POINTER(ctype)
+
+    def from_param(self, obj):
+        if obj is None or isinstance(obj, (ctypes.Array, ctypes._Pointer)):
+            return self.pointer.from_param(obj)
+        size = ctypes.sizeof(self.ctype)
+        iface = getattr(obj, '__array_interface__', None)
+        if iface is not None:
+            if iface.get('strides') is not None or int(iface['typestr'][2:]) != size:
+                raise TypeError("need a contiguous array of %d-byte items" % size)
+            return ctypes.cast(ctypes.c_void_p(iface['data'][0]), self.pointer)
+        if isinstance(obj, bytes):
+            return ctypes.cast(ctypes.c_char_p(obj), self.pointer)
+        view = memoryview(obj)
+        if not view.c_contiguous or view.itemsize != size:
+            raise TypeError("need a contiguous buffer of %d-byte items" % size)
+        if view.readonly:
+            raise TypeError("need a writable buffer")
+        return ctypes.cast((ctypes.c_char * view.nbytes).from_buffer(view), self.pointer)
+
+ailib.find_best_moves_batch.argtypes = [ctypes.c_void_p, _ArrayArg(ctypes.c_uint64), ctypes.c_size_t, _ArrayArg(ctypes.c_int), _ArrayArg(ctypes.c_float)]
+ailib.find_best_moves_batch.restype = None
+ailib.start_search.argtypes = [ctypes.c_void_p, ctypes.c_uint64, ctypes.c_uint, ctypes.c_uint64]
+ailib.start_search.restype = ctypes.c_void_p
+ailib.poll_search.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_int), ctypes.POINTER(ctypes.c_int)]
+ailib.cancel_search.argtypes = [ctypes.c_void_p]
+ailib.cancel_search.restype = None
+ailib.finish_search.argtypes = [ctypes.c_void_p, ctypes.POINTER(SearchStats)]
+ailib.find_best_move_timed.argtypes = [ctypes.c_void_p, ctypes.c_uint64, ctypes.c_uint, ctypes.c_uint64, ctypes.POINTER(SearchStats)]
+class HeurWeights(ctypes.Structure):
+    _fields_ = [
+        ('lost_penalty', ctypes.c_float),
+        ('monotonicity_power', ctypes.c_float),
+        ('monotonicity_weight', ctypes.c_float),
+        ('sum_power', ctypes.c_float),
+        ('sum_weight', ctypes.c_float),
+        ('merges_weight', ctypes.c_float),
+        ('empty_weight', ctypes.c_float),
+    ]
+
+ailib.get_default_heur_weights.argtypes = [ctypes.POINTER(HeurWeights)]
+ailib.get_default_heur_weights.restype = None
+ailib.set_heur_weights.argtypes = [ctypes.c_void_p, ctypes.POINTER(HeurWeights)]
+ailib.set_heur_weights.restype = None
+ailib.get_heur_weights.argtypes = [ctypes.c_void_p, ctypes.POINTER(HeurWeights)]
+ailib.get_heur_weights.restype = None
+ailib.set_ntuple_network.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+ailib.get_evaluator.argtypes = [ctypes.c_void_p]
+ailib.set_move_cache.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+ailib.set_search_option.argtypes = [ctypes.c_void_p, ctypes.c_int, ctypes.c_int]
+ailib.get_search_option.argtypes = [ctypes.c_void_p, ctypes.c_int]
+ailib.get_huge_page_bytes.argtypes = [ctypes.c_void_p]
+ailib.get_huge_page_bytes.restype = ctypes.c_uint64
+
+# Leaf evaluators (see 2048.h)
+EVALUATOR_HEURISTIC = 0
+EVALUATOR_NTUPLE = 1
+
+# Search options (see 2048.h)
+SEARCH_OPT_THREADS = 0
+SEARCH_OPT_VERBOSE = 1
+SEARCH_OPT_MAX_DEPTH = 2
+SEARCH_OPT_CANONICAL_KEYS = 3
+SEARCH_OPT_PRUNE = 4
+SEARCH_OPT_SAMPLE_EMPTY = 5
+SEARCH_OPT_SAMPLE_CELLS = 6
+SEARCH_OPT_ENGINE = 7
+SEARCH_OPT_MCTS_PLAYOUTS = 8
+SEARCH_OPT_MCTS_POLICY = 9
+SEARCH_OPT_HUGE_PAGES = 10
+
+# Search engines and MCTS playout policies (see 2048.h)
+SEARCH_ENGINE_EXPECTIMAX = 0
+SEARCH_ENGINE_MCTS = 1
+MCTS_PLAYOUT_RANDOM = 0
+MCTS_PLAYOUT_GREEDY = 1
+
+# What huge page backed memory got (see 2048.h)
+HUGE_PAGES_NONE = 0
+HUGE_PAGES_TRANSPARENT = 1
+HUGE_PAGES_EXPLICIT = 2
+
+class AsyncSearch(object):
+    ''' A search running in the background (see start_search in 2048.h); made by SearchContext.start_search. '''
+    def __init__(self, ctx, board, budget_ms, node_budget):
+        self.ctx = ctx # the context is the search's until it is finished
+        self.search = ailib.start_search(ctx.ctx, board, budget_ms, node_budget)
+
+    def poll(self):
+        ''' Returns (finished, best move so far, its depth). '''
+        move = ctypes.c_int()
+        depth = ctypes.c_int()
+        done = ailib.poll_search(self.search, ctypes.byref(move), ctypes.byref(depth))
+        return bool(done), move.value, depth.value
+
+    def cancel(self):
+        ailib.cancel_search(self.search)
+
+    def result(self):
+        ''' Wait for the search to finish; returns the move and its SearchStats. '''
+        stats = SearchStats()
+        move = ailib.finish_search(self.search, ctypes.byref(stats))
+        self.search = None
+        return move, stats
+
+    def __del__(self):
+        if self.search:
+            self.cancel()
+            self.result()
+
+class SearchContext(object):
+    ''' A search context owned by one game; keeps the transposition table warm between moves. '''
+    def __init__(self, trans_table_mb=0):
+        self.ctx = ailib.create_search_context(trans_table_mb)
+
+    def set_option(self, option, value):
+        ailib.set_search_option(self.ctx, option, value)
+
+    def huge_page_bytes(self):
+        ''' Bytes of the context's memory, and of the move tables, that sit in huge pages (slow; see 2048.h). '''
+        return ailib.get_huge_page_bytes(self.ctx)
+
+    def reset(self):
+        ailib.reset_search_context(self.ctx)
+
+    def set_heur_weights(self, **weights):
+        ''' Score boards with the built-in weights, except for the ones given by name (see HeurWeights). '''
+        w = HeurWeights()
+        ailib.get_default_heur_weights(ctypes.byref(w))
+        for name, value in weights.items():
+            setattr(w, name, value)
+        ailib.set_heur_weights(self.ctx, ctypes.byref(w))
+
+    def set_ntuple_network(self, path):
+        ''' Score leaves with the n-tuple network in the file at `path`, or with the heuristic again if path is None. '''
+        if ailib.set_ntuple_network(self.ctx, path.encode() if path is not None else None) < 0:
+            raise ValueError("can't load n-tuple network %r" % path)
+
+    def set_move_cache(self, path):
+        ''' Answer the positions in the move cache file at `path` without searching; None drops the cache. '''
+        if ailib.set_move_cache(self.ctx, path.encode() if path is not None else None) < 0:
+            raise ValueError("can't load move cache %r" % path)
+
+    def find_best_move_stats(self, board):
+        ''' Search a board (see to_c_board); returns the move and the SearchStats of the search. '''
+        stats = SearchStats()
+        move = ailib.find_best_move_stats(self.ctx, board, ctypes.byref(stats))
+        return move, stats
+
+    def start_search(self, board, budget_ms=0, node_budget=0):
+        ''' Search a board (see to_c_board) in the background; returns an AsyncSearch. '''
+        return AsyncSearch(self, board, budget_ms, node_budget)
+
+    def find_best_moves(self, boards, moves=None, scores=None):
+        ''' Search a batch of boards (see to_c_board) in one call, e.g. a NumPy uint64 array or
+        an array.array('Q'); see find_best_moves_batch in 2048.h. `moves` (int32, one per
+        board) and `scores` (float32, four per board), if given, are filled in place; moves is
+        otherwise a new array.array('i'). Returns moves. '''
+        n = memoryview(boards).nbytes // 8
+        if moves is None:
+            moves = array.array('i', bytes(4 * n))
+        if memoryview(moves).nbytes < 4 * n or (scores is not None and memoryview(scores).nbytes < 16 * n):
+            raise ValueError("output arrays are too short")
+        ailib.find_best_moves_batch(self.ctx, boards, n, moves, scores)
+        return moves
+
+    def close(self):
+        if self.ctx:
+            ailib.free_search_context(self.ctx)
+            self.ctx = None
+
+    def __del__(self):
+        self.close()
 
 def to_c_board(m):
     board = 0
@@ -0,0 +1,340 @@
+/* Headless benchmark driver.
+ *
+ * Plays a fixed set of seeded games with no per-move output and reports throughput,
+ * search statistics and game results as a single JSON object on stdout, so that engine
+ * changes can be gated on both speed and strength. Game i uses seed first_seed + i.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include "2048.h"
+
+struct bench_state {
+    search_context_t *ctx;
+    std::vector<double> latencies; // seconds per decision
+    uint64_t nodes;
+    uint64_t tt_probes;
+    uint64_t tt_hits;
+    uint64_t tt_entries; // summed over decisions
+    uint64_t completed_depth; // summed over decisions
+    uint64_t move_cache_hits;
+    uint64_t tt_stores;
+    uint64_t tt_overwrites;
+    uint64_t leaf_evals;
+    uint64_t prob_cutoffs;
+    uint64_t depth_cutoffs;
+    uint64_t prune_cutoffs;
+    uint64_t sampled_nodes;
+    uint64_t playouts;
+    uint64_t tree_nodes; // summed over decisions
+    int huge_pages; // of the last search
+    int table_huge_pages;
+    uint64_t nodes_by_depth[SEARCH_STATS_MAX_DEPTH];
+    double cpu_time;
+    unsigned budget_ms; // per-move budgets; with either set, moves come from find_best_move_timed
+    uint64_t node_budget;
+    search_context_t *check_ctx[2]; // with -V: iterative search with pruning on and off
+    uint64_t check_positions;
+    uint64_t check_differences; // positions where the moves differ
+    uint64_t check_mismatches; // ... by more than CHECK_PRUNE_TOLERANCE
+    double check_max_loss;
+
+    bench_state() : ctx(NULL), nodes(0), tt_probes(0), tt_hits(0), tt_entries(0), completed_depth(0), move_cache_hits(0), tt_stores(0), tt_overwrites(0), leaf_evals(0),
+        prob_cutoffs(0), depth_cutoffs(0), prune_cutoffs(0), sampled_nodes(0), playouts(0), tree_nodes(0), huge_pages(0), table_huge_pages(0), cpu_time(0), budget_ms(0), node_budget(0),
+        check_positions(0), check_differences(0), check_mismatches(0), check_max_loss(0) {
+        memset(nodes_by_depth, 0, sizeof(nodes_by_depth));
+        check_ctx[0] = check_ctx[1] = NULL;
+    }
+};
+
+/* Pruning only skips work that cannot change the move, so the same iterative search with
+ * and without it must agree on every position, up to near-ties: the transposition table
+ * reuses a score whatever the probability of the subtree it is reached through, so scores
+ * depend on the order the tree is visited in, by up to a few 1e-4 of their value, and
+ * pruning changes that order. A position only fails if the move chosen with pruning is
+ * worse, by the scores of the search without it, than this share of the best score. */
+static const double CHECK_PRUNE_TOLERANCE = 1e-3;
+
+static void check_prune(bench_state *bench, board_t board) {
+    int moves[2];
+    search_stats_t stats;
+    for (int i = 0; i < 2; i++) {
+        reset_search_context(bench->check_ctx[i]);
+        moves[i] = find_best_move_timed(bench->check_ctx[i], board, 0, 0, &stats);
+    }
+    bench->check_positions++;
+    if (moves[0] == moves[1])
+        return;
+    bench->check_differences++;
+    double loss = moves[1] < 0 ? 0 : moves[0] < 0 ? 1 : 1 - (double)stats.move_scores[moves[0]] / stats.move_scores[moves[1]];
+    if (loss > CHECK_PRUNE_TOLERANCE) {
+        bench->check_mismatches++;
+        fprintf(stderr, "board 0x%016llx: move %d with pruning, %d without, which is better by %.2e\n",
+            (unsigned long long)board, moves[0], moves[1], loss);
+    }
+    bench->check_max_loss = std::max(bench->check_max_loss, loss);
+}
+
+static int bench_get_move(board_t board, void *user) {
+    bench_state *bench = (bench_state *)user;
+    search_stats_t stats;
+
+    if (bench->check_ctx[0])
+        check_prune(bench, board);
+
+    int move;
+    if (bench->budget_ms || bench->node_budget)
+        move = find_best_move_timed(bench->ctx, board, bench->budget_ms, bench->node_budget, &stats);
+    else
+        move = find_best_move_stats(bench->ctx, board, &stats);
+
+    bench->latencies.push_back(stats.wall_time);
+    bench->cpu_time += stats.cpu_time;
+    bench->nodes += stats.moves_evaled;
+    bench->tt_probes += stats.tt_probes;
+    bench->tt_hits += stats.tt_hits;
+    bench->tt_entries += stats.tt_entries;
+    bench->completed_depth += stats.completed_depth;
+    bench->move_cache_hits += stats.move_cache_hit;
+    bench->tt_stores += stats.tt_stores;
+    bench->tt_overwrites += stats.tt_overwrites;
+    bench->leaf_evals += stats.leaf_evals;
+    bench->prob_cutoffs += stats.prob_cutoffs;
+    bench->depth_cutoffs += stats.depth_cutoffs;
+    bench->prune_cutoffs += stats.prune_cutoffs;
+    bench->sampled_nodes += stats.sampled_nodes;
+    bench->playouts += stats.playouts;
+    bench->tree_nodes += stats.tree_nodes;
+    if (!stats.move_cache_hit) {
+        bench->huge_pages = stats.huge_pages;
+        bench->table_huge_pages = stats.table_huge_pages;
+    }
+    for (int d = 0; d < SEARCH_STATS_MAX_DEPTH; d++)
+        bench->nodes_by_depth[d] += stats.nodes_by_depth[d];
+    return move;
+}
+
+// nearest-rank percentile of a sorted sample
+template<typename T>
+static T percentile(const std::vector<T> &sorted, double p) {
+    if (sorted.empty())
+        return T();
+    size_t rank = (size_t)(p / 100.0 * sorted.size());
+    return sorted[std::min(rank, sorted.size() - 1)];
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+        "Usage: %s [-n games] [-s first_seed] [-t threads] [-d max_depth] [-m trans_table_mb] [-c canonical_keys]\n"
+        "          [-l budget_ms] [-b node_budget] [-p prune] [-S sample_empty] [-C sample_cells] [-e ntuple_file] [-k move_cache]\n"
+        "          [-E engine] [-P playouts] [-y policy] [-H huge_pages] [-V check_prune]\n"
+        "  -n games          number of games to play (default 10)\n"
+        "  -s first_seed     seed of the first game; game i uses first_seed + i (default 1)\n"
+        "  -t threads        search threads, 0 = one per core (default 0)\n"
+        "  -d max_depth      cap on the search depth, 0 = none (default 0)\n"
+        "  -m trans_table_mb transposition table size (default 64)\n"
+        "  -c canonical_keys 1 = share table entries between symmetric boards, 0 = key on the raw board (default 0)\n"
+        "  -l budget_ms      per-move time budget for iterative deepening, 0 = none (default 0)\n"
+        "  -b node_budget    per-move node budget for iterative deepening, 0 = none (default 0)\n"
+        "  -p prune          1 = prune chance nodes that cannot change the move chosen, 0 = full expectimax (default 1)\n"
+        "  -S sample_empty   only search a sample of the tile placements on boards with more empty cells than this, 0 = never (default 0)\n"
+        "  -C sample_cells   cells in each such sample (default 4)\n"
+        "  -e ntuple_file    score leaves with this n-tuple network instead of the heuristic\n"
+        "  -k move_cache     answer the positions in this move cache without searching\n"
+        "  -E engine         0 = expectimax, 1 = Monte Carlo tree search; with MCTS, -b counts playouts (default 0)\n"
+        "  -P playouts       MCTS playouts per move when there is no budget (default 10000)\n"
+        "  -y policy         MCTS playouts: 0 = random moves, 1 = greedy by the evaluator (default 1)\n"
+        "  -H huge_pages     1 = put the transposition table, the MCTS node pool and the move tables in huge pages if possible (default 0)\n"
+        "  -V check_prune    1 = also search every position with single-threaded iterative deepening, capped at max_depth (or 3),\n"
+        "                    with and without pruning, and fail if pruning picks a move worse by more than 1e-3 (default 0)\n",
+        argv0);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    bench_state bench;
+    int games = 10;
+    uint64_t first_seed = 1;
+    int threads = 0;
+    int max_depth = 0;
+    unsigned trans_table_mb = 0;
+    int canonical_keys = 0;
+    int prune = 1;
+    int sample_empty = 0;
+    int sample_cells = 4;
+    const char *ntuple_fn = NULL;
+    const char *move_cache_fn = NULL;
+    int engine = SEARCH_ENGINE_EXPECTIMAX;
+    int playouts = 10000;
+    int policy = MCTS_PLAYOUT_GREEDY;
+    int huge_pages = 0;
+    int check = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc || argv[i][0] != '-' || strlen(argv[i]) != 2)
+            usage(argv[0]);
+        const char *arg = argv[++i];
+        switch (argv[i - 1][1]) {
+        case 'n': games = atoi(arg); break;
+        case 's': first_seed = strtoull(arg, NULL, 0); break;
+        case 't': threads = atoi(arg); break;
+        case 'd': max_depth = atoi(arg); break;
+        case 'm': trans_table_mb = atoi(arg); break;
+        case 'c': canonical_keys = atoi(arg); break;
+        case 'l': bench.budget_ms = atoi(arg); break;
+        case 'b': bench.node_budget = strtoull(arg, NULL, 0); break;
+        case 'p': prune = atoi(arg); break;
+        case 'S': sample_empty = atoi(arg); break;
+        case 'C': sample_cells = atoi(arg); break;
+        case 'e': ntuple_fn = arg; break;
+        case 'k': move_cache_fn = arg; break;
+        case 'E': engine = atoi(arg); break;
+        case 'P': playouts = atoi(arg); break;
+        case 'y': policy = atoi(arg); break;
+        case 'H': huge_pages = atoi(arg); break;
+        case 'V': check = atoi(arg); break;
+        default: usage(argv[0]);
+        }
+    }
+    if (games <= 0)
+        usage(argv[0]);
+
+    bench.ctx = create_search_context(trans_table_mb);
+    set_search_option(bench.ctx, SEARCH_OPT_VERBOSE, 0);
+    set_search_option(bench.ctx, SEARCH_OPT_THREADS, threads);
+    set_search_option(bench.ctx, SEARCH_OPT_MAX_DEPTH, max_depth);
+    set_search_option(bench.ctx, SEARCH_OPT_CANONICAL_KEYS, canonical_keys);
+    set_search_option(bench.ctx, SEARCH_OPT_PRUNE, prune);
+    set_search_option(bench.ctx, SEARCH_OPT_SAMPLE_EMPTY, sample_empty);
+    set_search_option(bench.ctx, SEARCH_OPT_SAMPLE_CELLS, sample_cells);
+    set_search_option(bench.ctx, SEARCH_OPT_ENGINE, engine);
+    set_search_option(bench.ctx, SEARCH_OPT_MCTS_PLAYOUTS, playouts);
+    set_search_option(bench.ctx, SEARCH_OPT_MCTS_POLICY, policy);
+    set_search_option(bench.ctx, SEARCH_OPT_HUGE_PAGES, huge_pages);
+    if (huge_pages)
+        use_huge_page_tables();
+    if (ntuple_fn && set_ntuple_network(bench.ctx, ntuple_fn) < 0)
+        return 1;
+    if (move_cache_fn && set_move_cache(bench.ctx, move_cache_fn) < 0)
+        return 1;
+
+    for (int i = 0; check && i < 2; i++) {
+        bench.check_ctx[i] = create_search_context(trans_table_mb);
+        set_search_option(bench.check_ctx[i], SEARCH_OPT_VERBOSE, 0);
+        set_search_option(bench.check_ctx[i], SEARCH_OPT_THREADS, 1);
+        set_search_option(bench.check_ctx[i], SEARCH_OPT_MAX_DEPTH, max_depth ? max_depth : 3);
+        set_search_option(bench.check_ctx[i], SEARCH_OPT_PRUNE, i == 0);
+    }
+
+    std::vector<game_result_t> results(games);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int i = 0; i < games; i++) {
+        reset_search_context(bench.ctx);
+        play_game_seeded(first_seed + i, bench_get_move, &bench, 0, &results[i]);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    uint64_t huge_page_bytes = get_huge_page_bytes(bench.ctx);
+    free_search_context(bench.ctx);
+    for (int i = 0; check && i < 2; i++)
+        free_search_context(bench.check_ctx[i]);
+
+    std::vector<double> latencies = bench.latencies;
+    std::sort(latencies.begin(), latencies.end());
+    double total_latency = 0;
+    for (size_t i = 0; i < latencies.size(); i++)
+        total_latency += latencies[i];
+
+    std::vector<uint32_t> scores;
+    int maxrank_counts[16] = {0};
+    for (int i = 0; i < games; i++) {
+        scores.push_back(results[i].score);
+        maxrank_counts[results[i].maxrank]++;
+    }
+    std::sort(scores.begin(), scores.end());
+    double total_score = 0;
+    for (size_t i = 0; i < scores.size(); i++)
+        total_score += scores[i];
+
+    size_t moves = latencies.size();
+    printf("{\n");
+    printf("  \"games\": %d,\n", games);
+    printf("  \"first_seed\": %llu,\n", (unsigned long long)first_seed);
+    printf("  \"threads\": %d,\n", threads);
+    printf("  \"max_depth\": %d,\n", max_depth);
+    printf("  \"canonical_keys\": %d,\n", canonical_keys);
+    printf("  \"prune\": %d,\n", prune);
+    printf("  \"sample_empty\": %d,\n", sample_empty);
+    printf("  \"sample_cells\": %d,\n", sample_cells);
+    printf("  \"evaluator\": \"%s\",\n", ntuple_fn ? "ntuple" : "heuristic");
+    printf("  \"engine\": \"%s\",\n", engine == SEARCH_ENGINE_MCTS ? "mcts" : "expectimax");
+    printf("  \"budget_ms\": %u,\n", bench.budget_ms);
+    printf("  \"node_budget\": %llu,\n", (unsigned long long)bench.node_budget);
+    printf("  \"elapsed_sec\": %.3f,\n", elapsed.count());
+    printf("  \"moves\": %lu,\n", (unsigned long)moves);
+    printf("  \"moves_per_sec\": %.2f,\n", moves / elapsed.count());
+    printf("  \"nodes\": %llu,\n", (unsigned long long)bench.nodes);
+    printf("  \"nodes_per_sec\": %.0f,\n", bench.nodes / elapsed.count());
+    printf("  \"tt_probes\": %llu,\n", (unsigned long long)bench.tt_probes);
+    printf("  \"tt_hits\": %llu,\n", (unsigned long long)bench.tt_hits);
+    printf("  \"tt_hit_rate\": %.4f,\n", bench.tt_probes ? (double)bench.tt_hits / bench.tt_probes : 0.0);
+    printf("  \"depth_mean\": %.2f,\n", moves ? (double)bench.completed_depth / moves : 0.0);
+    printf("  \"tt_entries_mean\": %.0f,\n", moves ? (double)bench.tt_entries / moves : 0.0);
+    printf("  \"tt_stores\": %llu,\n", (unsigned long long)bench.tt_stores);
+    printf("  \"tt_overwrites\": %llu,\n", (unsigned long long)bench.tt_overwrites);
+    printf("  \"leaf_evals\": %llu,\n", (unsigned long long)bench.leaf_evals);
+    printf("  \"cutoffs\": {\"prob\": %llu, \"depth\": %llu, \"prune\": %llu},\n", (unsigned long long)bench.prob_cutoffs,
+        (unsigned long long)bench.depth_cutoffs, (unsigned long long)bench.prune_cutoffs);
+    printf("  \"sampled_nodes\": %llu,\n", (unsigned long long)bench.sampled_nodes);
+    if (engine == SEARCH_ENGINE_MCTS) {
+        printf("  \"mcts\": {\"playouts\": %llu, \"policy\": \"%s\", \"tree_nodes_mean\": %.0f},\n", (unsigned long long)bench.playouts,
+            policy == MCTS_PLAYOUT_RANDOM ? "random" : "greedy",
+            moves ? (double)bench.tree_nodes / moves : 0.0);
+    }
+    printf("  \"nodes_by_depth\": [");
+    int last_depth = SEARCH_STATS_MAX_DEPTH;
+    while (last_depth > 1 && !bench.nodes_by_depth[last_depth - 1])
+        last_depth--;
+    for (int d = 0; d < last_depth; d++)
+        printf("%s%llu", d ? ", " : "", (unsigned long long)bench.nodes_by_depth[d]);
+    printf("],\n");
+    printf("  \"cpu_sec\": %.3f,\n", bench.cpu_time);
+    const char *page_kinds[] = {"none", "transparent", "explicit"};
+    printf("  \"huge_pages\": {\"search\": \"%s\", \"tables\": \"%s\", \"bytes\": %llu},\n", page_kinds[bench.huge_pages],
+        page_kinds[bench.table_huge_pages], (unsigned long long)huge_page_bytes);
+    printf("  \"move_cache_hits\": %llu,\n", (unsigned long long)bench.move_cache_hits);
+    if (check) {
+        printf("  \"prune_check\": {\"positions\": %llu, \"differences\": %llu, \"mismatches\": %llu, \"max_loss\": %.2e},\n",
+            (unsigned long long)bench.check_positions, (unsigned long long)bench.check_differences, (unsigned long long)bench.check_mismatches,
+            bench.check_max_loss);
+    }
+    printf("  \"latency_ms\": {\"mean\": %.3f, \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f},\n",
+        moves ? 1000 * total_latency / moves : 0.0, 1000 * percentile(latencies, 50), 1000 * percentile(latencies, 90),
+        1000 * percentile(latencies, 99), moves ? 1000 * latencies.back() : 0.0);
+    printf("  \"score\": {\"mean\": %.1f, \"min\": %u, \"p50\": %u, \"p90\": %u, \"max\": %u},\n",
+        total_score / games, scores.front(), percentile(scores, 50), percentile(scores, 90), scores.back());
+    printf("  \"max_tile\": {");
+    const char *sep = "";
+    for (int rank = 0; rank < 16; rank++) {
+        if (maxrank_counts[rank]) {
+            printf("%s\"%d\": %d", sep, 1 << rank, maxrank_counts[rank]);
+            sep = ", ";
+        }
+    }
+    printf("},\n");
+    printf("  \"results\": [\n");
+    for (int i = 0; i < games; i++) {
+        printf("    {\"seed\": %llu, \"score\": %u, \"max_tile\": %d, \"moves\": %d}%s\n",
+            (unsigned long long)(first_seed + i), results[i].score, 1 << results[i].maxrank, results[i].moves,
+            (i + 1 < games) ? "," : "");
+    }
+    printf("  ]\n");
+    printf("}\n");
+
+    return bench.check_mismatches ? 1 : 0;
+}
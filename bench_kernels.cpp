@@ -0,0 +1,265 @@
+/* Kernel microbenchmark.
+ *
+ * Times the board primitives and the move and scoring kernels one at a time over a corpus
+ * of boards taken from seeded self-play games (or from a game record file), so that the
+ * table lookups see the same spread of rows as a real search. Kernels with vectorized
+ * variants are run with every instruction set the CPU supports, side by side. Each kernel
+ * is warmed up, then timed over several runs of at least a few milliseconds each; the
+ * spread of the runs is reported with the times, as JSON, in nanoseconds per board. Build
+ * the binary with and without COMPACT_TABLES to compare the table layouts.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include "2048.h"
+#include "board.h"
+#include "game_record.h"
+
+static int record_move(board_t board, void *user) {
+    std::vector<board_t> *corpus = (std::vector<board_t> *)user;
+    corpus->push_back(board);
+    return find_best_move(board);
+}
+
+static volatile board_t board_sink;
+static volatile float float_sink;
+static volatile int int_sink;
+
+struct kernel_run {
+    const std::vector<board_t> *boards;
+    std::vector<board_t> out;
+    std::vector<uint8_t> masks;
+    std::vector<float> scores;
+};
+
+static void run_transpose(kernel_run &run) {
+    const std::vector<board_t> &boards = *run.boards;
+    board_t acc = 0;
+    for (size_t i = 0; i < boards.size(); i++)
+        acc ^= transpose(boards[i]);
+    board_sink = acc;
+}
+
+static void run_count_empty(kernel_run &run) {
+    const std::vector<board_t> &boards = *run.boards;
+    int acc = 0;
+    for (size_t i = 0; i < boards.size(); i++)
+        acc += count_empty(boards[i]);
+    int_sink = acc;
+}
+
+static void run_get_max_rank(kernel_run &run) {
+    const std::vector<board_t> &boards = *run.boards;
+    int acc = 0;
+    for (size_t i = 0; i < boards.size(); i++)
+        acc += get_max_rank(boards[i]);
+    int_sink = acc;
+}
+
+static void run_count_distinct_tiles(kernel_run &run) {
+    const std::vector<board_t> &boards = *run.boards;
+    int acc = 0;
+    for (size_t i = 0; i < boards.size(); i++)
+        acc += count_distinct_tiles(boards[i]);
+    int_sink = acc;
+}
+
+template <int MOVE>
+static void run_execute_move(kernel_run &run) {
+    const std::vector<board_t> &boards = *run.boards;
+    board_t acc = 0;
+    for (size_t i = 0; i < boards.size(); i++)
+        acc ^= execute_move(MOVE, boards[i]);
+    board_sink = acc;
+}
+
+static void run_expand_moves(kernel_run &run) {
+    expand_moves_batch(run.boards->data(), run.boards->size(), run.out.data(), run.masks.data());
+    board_sink = run.out[0];
+}
+
+static void run_score_heur_boards(kernel_run &run) {
+    score_heur_boards(run.boards->data(), run.boards->size(), run.scores.data());
+    float_sink = run.scores[0];
+}
+
+struct kernel_timing {
+    int passes; // over the corpus, per timed run
+    double min, median, mean, stddev; // nanoseconds per board
+};
+
+static double time_passes(void (*kernel)(kernel_run &), kernel_run &run, int passes) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int p = 0; p < passes; p++)
+        kernel(run);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+/* Warm up (which also picks the number of passes that makes a run last min_run_ms), then
+ * time `repeats` runs. */
+static kernel_timing time_kernel(void (*kernel)(kernel_run &), kernel_run &run, int warmup, int repeats, double min_run_ms) {
+    kernel_timing timing;
+    timing.passes = 1;
+    for (int w = 0; w < warmup; w++) {
+        double elapsed = time_passes(kernel, run, timing.passes);
+        if (elapsed * 1e3 < min_run_ms)
+            timing.passes = std::max(timing.passes, (int)ceil(timing.passes * min_run_ms / std::max(elapsed * 1e3, 1e-3)));
+    }
+
+    std::vector<double> ns(repeats);
+    double per_run = 1e9 / ((double)run.boards->size() * timing.passes);
+    for (int r = 0; r < repeats; r++)
+        ns[r] = time_passes(kernel, run, timing.passes) * per_run;
+    std::sort(ns.begin(), ns.end());
+    timing.min = ns[0];
+    timing.median = (repeats % 2) ? ns[repeats / 2] : (ns[repeats / 2 - 1] + ns[repeats / 2]) / 2;
+    timing.mean = 0;
+    for (int r = 0; r < repeats; r++)
+        timing.mean += ns[r] / repeats;
+    timing.stddev = 0;
+    for (int r = 0; r < repeats; r++)
+        timing.stddev += (ns[r] - timing.mean) * (ns[r] - timing.mean);
+    timing.stddev = (repeats > 1) ? sqrt(timing.stddev / (repeats - 1)) : 0;
+    return timing;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+        "Usage: %s [-n games] [-s first_seed] [-i record_file] [-w warmup] [-r repeats] [-t min_run_ms] [-H huge_pages]\n"
+        "  -n games       self-play games to take the boards from (default 4)\n"
+        "  -s first_seed  seed of the first game; game i uses first_seed + i (default 1)\n"
+        "  -i record_file take the boards from this game record instead (see bin/2048 selfplay -r)\n"
+        "  -w warmup      untimed runs of each kernel before the timed ones (default 2)\n"
+        "  -r repeats     timed runs of each kernel (default 10)\n"
+        "  -t min_run_ms  run each kernel over the corpus as many times as it takes to last this long (default 10)\n"
+        "  -H huge_pages  1 = read the move and score tables from a huge page if possible (default 0)\n",
+        argv0);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    int games = 4;
+    uint64_t first_seed = 1;
+    const char *record_fn = NULL;
+    int warmup = 2;
+    int repeats = 10;
+    double min_run_ms = 10;
+    int huge_pages = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc || argv[i][0] != '-' || strlen(argv[i]) != 2)
+            usage(argv[0]);
+        const char *arg = argv[++i];
+        switch (argv[i - 1][1]) {
+        case 'n': games = atoi(arg); break;
+        case 's': first_seed = strtoull(arg, NULL, 0); break;
+        case 'i': record_fn = arg; break;
+        case 'w': warmup = atoi(arg); break;
+        case 'r': repeats = atoi(arg); break;
+        case 't': min_run_ms = atof(arg); break;
+        case 'H': huge_pages = atoi(arg); break;
+        default: usage(argv[0]);
+        }
+    }
+    if (games <= 0 || warmup < 0 || repeats <= 0 || min_run_ms < 0)
+        usage(argv[0]);
+
+    const char *page_kinds[] = {"none", "transparent", "explicit"};
+    int table_pages = huge_pages ? use_huge_page_tables() : HUGE_PAGES_NONE;
+
+    // positions: the boards of games; leaves: their successors, as scored at the leaves of a search
+    std::vector<board_t> positions;
+    if (record_fn) {
+        game_record_file *records = game_record_file::load(record_fn);
+        if (!records)
+            return 1;
+        for (uint64_t i = 0; i < records->count; i++)
+            positions.push_back(records->plies[i].board);
+        delete records;
+        if (positions.empty()) {
+            fprintf(stderr, "%s: no games recorded\n", record_fn);
+            return 1;
+        }
+    } else {
+        set_search_option(NULL, SEARCH_OPT_THREADS, 1);
+        set_search_option(NULL, SEARCH_OPT_MAX_DEPTH, 2);
+        for (int i = 0; i < games; i++) {
+            game_result_t result;
+            play_game_seeded(first_seed + i, record_move, &positions, 0, &result);
+        }
+    }
+    std::vector<board_t> leaves(4 * positions.size());
+    std::vector<uint8_t> masks(positions.size());
+    expand_moves_batch(positions.data(), positions.size(), leaves.data(), masks.data());
+
+    kernel_run position_run;
+    position_run.boards = &positions;
+    position_run.out.resize(4 * positions.size());
+    position_run.masks.resize(positions.size());
+
+    kernel_run leaf_run;
+    leaf_run.boards = &leaves;
+    leaf_run.scores.resize(leaves.size());
+
+    struct {
+        const char *name;
+        void (*kernel)(kernel_run &);
+        kernel_run *run;
+        bool per_isa;
+    } kernels[] = {
+        {"transpose", run_transpose, &position_run, false},
+        {"count_empty", run_count_empty, &position_run, false},
+        {"get_max_rank", run_get_max_rank, &position_run, false},
+        {"count_distinct_tiles", run_count_distinct_tiles, &position_run, false},
+        {"execute_move_up", run_execute_move<0>, &position_run, false},
+        {"execute_move_down", run_execute_move<1>, &position_run, false},
+        {"execute_move_left", run_execute_move<2>, &position_run, false},
+        {"execute_move_right", run_execute_move<3>, &position_run, false},
+        {"expand_moves_batch", run_expand_moves, &position_run, true},
+        {"score_heur_boards", run_score_heur_boards, &leaf_run, true},
+    };
+    const char *isa_names[] = {"scalar", "avx2"};
+
+    int native_isa = get_kernel_isa();
+    printf("{\n");
+#ifdef COMPACT_TABLES
+    printf("  \"layout\": \"compact\",\n");
+#else
+    printf("  \"layout\": \"default\",\n");
+#endif
+    printf("  \"table_huge_pages\": \"%s\",\n", page_kinds[table_pages]);
+    printf("  \"corpus\": \"%s\",\n", record_fn ? "record" : "selfplay");
+    printf("  \"positions\": %lu,\n", (unsigned long)positions.size());
+    printf("  \"leaves\": %lu,\n", (unsigned long)leaves.size());
+    printf("  \"warmup\": %d,\n", warmup);
+    printf("  \"repeats\": %d,\n", repeats);
+    printf("  \"kernels\": [\n");
+    const char *sep = "";
+    for (size_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++) {
+        double scalar_median = 0;
+        for (int isa = KERNEL_ISA_SCALAR; isa <= native_isa; isa++) {
+            if (!kernels[k].per_isa && isa != KERNEL_ISA_SCALAR)
+                continue;
+            set_kernel_isa(isa);
+            kernel_timing t = time_kernel(kernels[k].kernel, *kernels[k].run, warmup, repeats, min_run_ms);
+            if (isa == KERNEL_ISA_SCALAR)
+                scalar_median = t.median;
+            printf("%s    {\"kernel\": \"%s\", \"isa\": \"%s\", \"passes\": %d, \"ns_per_board\": %.3f, \"ns_min\": %.3f, "
+                "\"ns_mean\": %.3f, \"ns_stddev\": %.3f, \"mboards_per_sec\": %.1f, \"speedup\": %.2f}",
+                sep, kernels[k].name, isa_names[isa], t.passes, t.median, t.min, t.mean, t.stddev, 1e3 / t.median,
+                scalar_median / t.median);
+            sep = ",\n";
+        }
+    }
+    set_kernel_isa(native_isa);
+    printf("\n  ]\n");
+    printf("}\n");
+    return 0;
+}
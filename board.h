@@ -0,0 +1,99 @@
+#ifndef BOARD_H
+#define BOARD_H
+
+#include <algorithm>
+
+#include "2048.h"
+
+/* Bit tricks on whole boards. They are inlined into the search, and are here rather than
+ * in 2048.cpp so that bin/2048-bench-kernels can time the same code on its own. */
+
+// Transpose rows/columns in a board:
+//   0123       048c
+//   4567  -->  159d
+//   89ab       26ae
+//   cdef       37bf
+static inline board_t transpose(board_t x)
+{
+    board_t a1 = x & 0xF0F00F0FF0F00F0FULL;
+    board_t a2 = x & 0x0000F0F00000F0F0ULL;
+    board_t a3 = x & 0x0F0F00000F0F0000ULL;
+    board_t a = a1 | (a2 << 12) | (a3 >> 12);
+    board_t b1 = a & 0xFF00FF0000FF00FFULL;
+    board_t b2 = a & 0x00FF00FF00000000ULL;
+    board_t b3 = a & 0x00000000FF00FF00ULL;
+    return b1 | (b2 >> 24) | (b3 << 24);
+}
+
+// Mirror a board left-to-right: reverse the order of the tiles within each row.
+static inline board_t mirror_rows(board_t x)
+{
+    x = ((x & 0x00FF00FF00FF00FFULL) << 8) | ((x >> 8) & 0x00FF00FF00FF00FFULL);
+    return ((x & 0x0F0F0F0F0F0F0F0FULL) << 4) | ((x >> 4) & 0x0F0F0F0F0F0F0F0FULL);
+}
+
+// Mirror a board top-to-bottom: reverse the order of the rows.
+static inline board_t mirror_cols(board_t x)
+{
+    x = (x << 32) | (x >> 32);
+    return ((x & 0x0000FFFF0000FFFFULL) << 16) | ((x >> 16) & 0x0000FFFF0000FFFFULL);
+}
+
+// The least of a board's 8 rotations and reflections. Symmetric positions have the same
+// expectimax value, since both the game and the heuristic treat rows and columns alike.
+static inline board_t canonical_board(board_t x)
+{
+    board_t h = mirror_rows(x);
+    board_t v = mirror_cols(x);
+    board_t hv = mirror_cols(h);
+    board_t best = std::min(std::min(x, h), std::min(v, hv));
+    board_t best_t = std::min(std::min(transpose(x), transpose(h)), std::min(transpose(v), transpose(hv)));
+    return std::min(best, best_t);
+}
+
+// Count the number of empty positions (= zero nibbles) in a board.
+// Precondition: the board cannot be fully empty.
+static inline int count_empty(board_t x)
+{
+    x |= (x >> 2) & 0x3333333333333333ULL;
+    x |= (x >> 1);
+    x = ~x & 0x1111111111111111ULL;
+    // At this point each nibble is:
+    //  0 if the original nibble was non-zero
+    //  1 if the original nibble was zero
+    // Next sum them all
+    x += x >> 32;
+    x += x >> 16;
+    x += x >>  8;
+    x += x >>  4; // this can overflow to the next nibble if there were 16 empty positions
+    return x & 0xf;
+}
+
+static inline int get_max_rank(board_t board) {
+    int maxrank = 0;
+    while (board) {
+        maxrank = std::max(maxrank, int(board & 0xf));
+        board >>= 4;
+    }
+    return maxrank;
+}
+
+static inline int count_distinct_tiles(board_t board) {
+    uint16_t bitset = 0;
+    while (board) {
+        bitset |= 1<<(board & 0xf);
+        board >>= 4;
+    }
+
+    // Don't count empty tiles.
+    bitset >>= 1;
+
+    int count = 0;
+    while (bitset) {
+        bitset &= bitset - 1;
+        count++;
+    }
+    return count;
+}
+
+#endif /* BOARD_H */
@@ -0,0 +1,163 @@
+/* Offline move cache builder.
+ *
+ * Positions are collected by the self-play farm, which reports every position its games
+ * reach; the ones that come up in the most games are what a cache can save searches on.
+ * Each selected position then gets a deep search of all four moves, spread over threads
+ * with one single-threaded search context each, like the games themselves.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "build_move_cache.h"
+#include "move_cache.h"
+#include "selfplay.h"
+
+struct position_counts {
+    std::mutex lock;
+    std::unordered_map<board_t, int> counts;
+};
+
+static void count_position(board_t board, void *user) {
+    position_counts *positions = (position_counts *)user;
+    std::lock_guard<std::mutex> guard(positions->lock);
+    positions->counts[board]++;
+}
+
+static bool more_frequent(const std::pair<board_t, int> &a, const std::pair<board_t, int> &b) {
+    return a.second > b.second || (a.second == b.second && a.first < b.first);
+}
+
+struct deep_search_shared {
+    std::vector<move_cache_entry> *entries;
+    int max_depth;
+    unsigned trans_table_mb;
+    std::atomic<size_t> next;
+};
+
+static void deep_search_worker(deep_search_shared *shared) {
+    search_context_t *ctx = create_search_context(shared->trans_table_mb);
+    set_search_option(ctx, SEARCH_OPT_VERBOSE, 0);
+    set_search_option(ctx, SEARCH_OPT_THREADS, 1);
+    set_search_option(ctx, SEARCH_OPT_MAX_DEPTH, shared->max_depth);
+
+    while (true) {
+        size_t index = shared->next++;
+        if (index >= shared->entries->size())
+            break;
+        move_cache_entry &entry = (*shared->entries)[index];
+        // start each position from an empty table, so that its scores do not depend on which
+        // positions this thread happened to search before it
+        reset_search_context(ctx);
+        for (int move = 0; move < 4; move++)
+            entry.scores[move] = score_toplevel_move_ctx(ctx, entry.board, move);
+    }
+
+    free_search_context(ctx);
+}
+
+static void build_usage(const char *argv0) {
+    fprintf(stderr,
+        "Usage: %s build-move-cache -o out_file [-n games] [-s first_seed] [-g play_depth] [-c min_count]\n"
+        "          [-N max_positions] [-d max_depth] [-j threads] [-m trans_table_mb]\n"
+        "  -o out_file       cache file to write\n"
+        "  -n games          self-play games to collect positions from (default 1000)\n"
+        "  -s first_seed     seed of the first game; game i uses first_seed + i (default 1)\n"
+        "  -g play_depth     depth cap of the searches playing those games (default 2)\n"
+        "  -c min_count      only cache positions reached at least this often (default 2)\n"
+        "  -N max_positions  cache at most this many positions, the most frequent first (default 100000)\n"
+        "  -d max_depth      depth cap of the searches filling the cache, 0 = none (default 0)\n"
+        "  -j threads        concurrent games and searches, 0 = one per core (default 0)\n"
+        "  -m trans_table_mb transposition table size per thread (default 64)\n",
+        argv0);
+    exit(1);
+}
+
+int build_move_cache_main(int argc, char **argv) {
+    const char *out_fn = NULL;
+    selfplay_config config;
+    config.games = 1000;
+    config.max_depth = 2;
+    config.trans_table_mb = 16;
+    int min_count = 2;
+    size_t max_positions = 100000;
+    int max_depth = 0;
+    unsigned trans_table_mb = 64;
+
+    for (int i = 2; i < argc; i++) {
+        if (i + 1 >= argc || argv[i][0] != '-' || strlen(argv[i]) != 2)
+            build_usage(argv[0]);
+        const char *arg = argv[++i];
+        switch (argv[i - 1][1]) {
+        case 'o': out_fn = arg; break;
+        case 'n': config.games = atoi(arg); break;
+        case 's': config.first_seed = strtoull(arg, NULL, 0); break;
+        case 'g': config.max_depth = atoi(arg); break;
+        case 'c': min_count = atoi(arg); break;
+        case 'N': max_positions = strtoull(arg, NULL, 0); break;
+        case 'd': max_depth = atoi(arg); break;
+        case 'j': config.threads = atoi(arg); break;
+        case 'm': trans_table_mb = atoi(arg); break;
+        default: build_usage(argv[0]);
+        }
+    }
+    if (!out_fn || config.games <= 0)
+        build_usage(argv[0]);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    position_counts positions;
+    config.observe = count_position;
+    config.observe_user = &positions;
+    run_selfplay(config, NULL, NULL);
+    std::chrono::duration<double> play_elapsed = std::chrono::steady_clock::now() - start;
+
+    std::vector<std::pair<board_t, int> > frequent;
+    for (std::unordered_map<board_t, int>::const_iterator it = positions.counts.begin(); it != positions.counts.end(); ++it) {
+        if (it->second >= min_count)
+            frequent.push_back(*it);
+    }
+    std::sort(frequent.begin(), frequent.end(), more_frequent);
+    if (frequent.size() > max_positions)
+        frequent.resize(max_positions);
+
+    uint64_t covered = 0, total = 0;
+    for (std::unordered_map<board_t, int>::const_iterator it = positions.counts.begin(); it != positions.counts.end(); ++it)
+        total += it->second;
+    std::vector<move_cache_entry> entries(frequent.size());
+    for (size_t i = 0; i < frequent.size(); i++) {
+        entries[i].board = frequent[i].first;
+        covered += frequent[i].second;
+    }
+
+    deep_search_shared shared;
+    shared.entries = &entries;
+    shared.max_depth = max_depth;
+    shared.trans_table_mb = trans_table_mb;
+    shared.next = 0;
+    int threads = config.threads > 0 ? config.threads : std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; i++)
+        workers.push_back(std::thread(deep_search_worker, &shared));
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+
+    if (!move_cache::write(out_fn, entries, max_depth))
+        return 1;
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    printf("{\"games\": %d, \"positions_seen\": %llu, \"distinct_positions\": %llu, \"cached_positions\": %llu, "
+        "\"cached_share\": %.4f, \"play_sec\": %.3f, \"elapsed_sec\": %.3f}\n",
+        config.games, (unsigned long long)total, (unsigned long long)positions.counts.size(),
+        (unsigned long long)entries.size(), total ? (double)covered / total : 0.0, play_elapsed.count(), elapsed.count());
+    return 0;
+}
@@ -0,0 +1,9 @@
+#ifndef BUILD_MOVE_CACHE_H
+#define BUILD_MOVE_CACHE_H
+
+/* `bin/2048 build-move-cache ...`: find the positions that come up most often in seeded
+ * self-play games, search each of them deeply, and write the results as a move cache
+ * (see move_cache.h). */
+int build_move_cache_main(int argc, char **argv);
+
+#endif /* BUILD_MOVE_CACHE_H */
@@ -0,0 +1,622 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "farm.h"
+#include "game_record.h"
+#include "selfplay.h"
+
+#ifndef _WIN32
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+static_assert(sizeof(farm_header) == 8, "farm_header is part of the wire format");
+static_assert(sizeof(farm_hello) == 16, "farm_hello is part of the wire format");
+static_assert(sizeof(farm_settings) == 32, "farm_settings is part of the wire format");
+static_assert(sizeof(farm_result) == 32, "farm_result is part of the wire format");
+static_assert(sizeof(game_record_ply) == 16, "game_record_ply is part of the wire format");
+
+static const char FARM_MAGIC[8] = {'2', '0', '4', '8', 'F', 'A', 'R', 'M'};
+static const uint32_t FARM_MAX_PLIES = 1 << 24; // far more than any game lasts
+
+struct coordinator_config {
+    const char *port;
+    farm_settings settings;
+    const char *record_fn;
+    int timeout_sec; // drop a worker not heard from for this long
+
+    coordinator_config() : port(NULL), record_fn(NULL), timeout_sec(30) {
+        memset(&settings, 0, sizeof(settings));
+    }
+};
+
+#ifndef _WIN32
+
+static bool read_full(int fd, void *buf, size_t len) {
+    char *p = (char *)buf;
+    while (len) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool write_full(int fd, const void *buf, size_t len) {
+    const char *p = (const char *)buf;
+    while (len) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+/* Send a message whose body is `body` followed by `extra`, in one write. */
+static bool send_message(int fd, uint32_t type, const void *body, size_t length, const void *extra = NULL, size_t extra_length = 0) {
+    std::vector<char> buf(sizeof(farm_header) + length + extra_length);
+    farm_header header;
+    header.type = type;
+    header.length = length + extra_length;
+    memcpy(&buf[0], &header, sizeof(header));
+    if (length)
+        memcpy(&buf[sizeof(header)], body, length);
+    if (extra_length)
+        memcpy(&buf[sizeof(header) + length], extra, extra_length);
+    return write_full(fd, &buf[0], buf.size());
+}
+
+/* Read the next message, which must be of type `type` with a body of `length` bytes. */
+static bool read_message(int fd, uint32_t type, void *body, size_t length) {
+    farm_header header;
+    return read_full(fd, &header, sizeof(header)) && header.type == type && header.length == length &&
+        read_full(fd, body, length);
+}
+
+static void set_nodelay(int fd) {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+/* Coordinator */
+
+struct farm_conn {
+    int fd;
+    int id;
+    std::string peer; // address:port
+    uint32_t threads; // from its hello; 0 until then
+    std::set<uint32_t> games; // handed out and not finished
+    int finished;
+
+    farm_conn(int fd, int id, const std::string &peer) : fd(fd), id(id), peer(peer), threads(0), finished(0) {
+    }
+};
+
+struct coordinator_state {
+    const coordinator_config *config;
+    std::mutex lock; // guards everything below, and the output
+    std::condition_variable changed;
+    std::deque<uint32_t> queue; // games to hand out, in order
+    std::vector<bool> done; // per game
+    std::set<farm_conn *> conns;
+    int games_done;
+    int reassigned;
+    int workers_seen;
+    selfplay_summary summary;
+};
+
+/* Keep the worker one game ahead of its threads. */
+static void top_up(coordinator_state *state, farm_conn *conn) {
+    while (conn->threads && conn->games.size() <= conn->threads && !state->queue.empty()) {
+        farm_game game;
+        game.index = state->queue.front();
+        state->queue.pop_front();
+        conn->games.insert(game.index);
+        if (!send_message(conn->fd, FARM_GAME, &game, sizeof(game))) {
+            // the connection's thread sees the failure too, and requeues the games
+            shutdown(conn->fd, SHUT_RDWR);
+            break;
+        }
+    }
+}
+
+static void record_result(coordinator_state *state, farm_conn *conn, const farm_result &result, const std::vector<game_record_ply> &plies) {
+    // a game not held by this worker is a stray; the worker is out of step with the coordinator
+    if (!conn->games.erase(result.index) || state->done[result.index])
+        return;
+    state->done[result.index] = true;
+    state->games_done++;
+    conn->finished++;
+
+    selfplay_game game;
+    game.index = result.index;
+    game.vector = 0;
+    game.seed = state->config->settings.first_seed + result.index;
+    game.result.board = result.board;
+    game.result.score = result.score;
+    game.result.maxrank = result.maxrank;
+    game.result.moves = result.moves;
+    game.elapsed = result.elapsed_us / 1e6;
+    game.plies = &plies;
+    print_selfplay_game(game, &state->summary);
+
+    if (state->games_done == (int)state->done.size())
+        state->changed.notify_all();
+    else
+        top_up(state, conn);
+}
+
+/* Talk to one worker until it hangs up, goes quiet or the run ends; then put the games it
+ * still held back in the queue for the others. */
+static void coordinate_worker(coordinator_state *state, farm_conn *conn) {
+    const coordinator_config &config = *state->config;
+    struct timeval timeout;
+    timeout.tv_sec = config.timeout_sec;
+    timeout.tv_usec = 0;
+    setsockopt(conn->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    set_nodelay(conn->fd);
+
+    const char *reason = "disconnected";
+    farm_hello hello;
+    if (!read_message(conn->fd, FARM_HELLO, &hello, sizeof(hello)) || memcmp(hello.magic, FARM_MAGIC, sizeof(FARM_MAGIC)) ||
+            hello.version != FARM_VERSION || hello.threads == 0) {
+        reason = "not a worker of this version";
+    } else if (send_message(conn->fd, FARM_SETTINGS, &config.settings, sizeof(config.settings))) {
+        {
+            std::lock_guard<std::mutex> guard(state->lock);
+            conn->threads = hello.threads;
+            state->workers_seen++;
+            fprintf(stderr, "Worker %d (%s) joined with %u threads\n", conn->id, conn->peer.c_str(), hello.threads);
+            top_up(state, conn);
+        }
+
+        farm_header header;
+        farm_result result;
+        std::vector<game_record_ply> plies;
+        while (true) {
+            errno = 0;
+            if (!read_full(conn->fd, &header, sizeof(header))) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                    reason = "timed out";
+                break;
+            }
+            if (header.type == FARM_HEARTBEAT && header.length == 0)
+                continue;
+            if (header.type != FARM_RESULT || header.length < sizeof(result) || !read_full(conn->fd, &result, sizeof(result)) ||
+                    result.plies > FARM_MAX_PLIES || header.length != sizeof(result) + result.plies * sizeof(game_record_ply) ||
+                    result.index >= config.settings.games) {
+                reason = "protocol error";
+                break;
+            }
+            plies.resize(result.plies);
+            if (result.plies && !read_full(conn->fd, &plies[0], result.plies * sizeof(game_record_ply)))
+                break;
+            std::lock_guard<std::mutex> guard(state->lock);
+            record_result(state, conn, result, plies);
+        }
+    }
+
+    std::lock_guard<std::mutex> guard(state->lock);
+    state->conns.erase(conn);
+    if (conn->threads && state->games_done < (int)state->done.size()) {
+        // back to the front of the queue, so lost games do not end up last
+        for (std::set<uint32_t>::reverse_iterator it = conn->games.rbegin(); it != conn->games.rend(); ++it)
+            state->queue.push_front(*it);
+        state->reassigned += conn->games.size();
+        fprintf(stderr, "Worker %d (%s) %s after %d games; %d games go back to the queue\n",
+            conn->id, conn->peer.c_str(), reason, conn->finished, (int)conn->games.size());
+        for (std::set<farm_conn *>::iterator it = state->conns.begin(); it != state->conns.end(); ++it)
+            top_up(state, *it);
+    } else if (!conn->threads) {
+        fprintf(stderr, "Connection from %s dropped: %s\n", conn->peer.c_str(), reason);
+    }
+    close(conn->fd);
+    delete conn;
+    state->changed.notify_all();
+}
+
+static int listen_tcp(const char *port) {
+    struct addrinfo hints, *addrs;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    int err = getaddrinfo(NULL, port, &hints, &addrs);
+    if (err) {
+        fprintf(stderr, "port %s: %s\n", port, gai_strerror(err));
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo *addr = addrs; addr && fd < 0; addr = addr->ai_next) {
+        fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+        if (fd < 0)
+            continue;
+        int one = 1, zero = 0;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (addr->ai_family == AF_INET6) // take IPv4 connections too
+            setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &zero, sizeof(zero));
+        if (bind(fd, addr->ai_addr, addr->ai_addrlen) < 0 || listen(fd, 64) < 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addrs);
+    if (fd < 0)
+        perror("listen");
+    return fd;
+}
+
+static std::string socket_name(const struct sockaddr *addr, socklen_t len) {
+    char host[NI_MAXHOST], port[NI_MAXSERV];
+    if (getnameinfo(addr, len, host, sizeof(host), port, sizeof(port), NI_NUMERICHOST | NI_NUMERICSERV))
+        return "?";
+    return std::string(host) + ":" + port;
+}
+
+#endif /* _WIN32 */
+
+static void coordinator_usage(const char *argv0) {
+    fprintf(stderr,
+        "Usage: %s coordinator [-p port] [-n games] [-s first_seed] [-d max_depth] [-m trans_table_mb] [-E engine] [-P playouts]\n"
+        "          [-r record_file] [-t timeout_sec]\n"
+        "  -p port           TCP port to listen on for workers, 0 = any free port (default 2048)\n"
+        "  -n games          number of games to play (default 100)\n"
+        "  -s first_seed     seed of the first game; game i uses first_seed + i (default 1)\n"
+        "  -d max_depth      cap on the search depth, 0 = none (default 0)\n"
+        "  -m trans_table_mb transposition table size per worker thread (default 16)\n"
+        "  -E engine         0 = expectimax, 1 = Monte Carlo tree search (default 0)\n"
+        "  -P playouts       MCTS playouts per move (default 10000)\n"
+        "  -r record_file    collect every move of every game into this file (see game_record.h)\n"
+        "  -t timeout_sec    drop a worker not heard from for this long, and reassign its games (default 30)\n",
+        argv0);
+    exit(1);
+}
+
+int coordinator_main(int argc, char **argv) {
+    coordinator_config config;
+    config.settings.first_seed = 1;
+    config.settings.games = 100;
+    config.settings.trans_table_mb = 16;
+    config.settings.engine = SEARCH_ENGINE_EXPECTIMAX;
+    char default_port[16];
+    snprintf(default_port, sizeof(default_port), "%d", FARM_DEFAULT_PORT);
+    config.port = default_port;
+
+    for (int i = 2; i < argc; i++) {
+        if (i + 1 >= argc || argv[i][0] != '-' || strlen(argv[i]) != 2)
+            coordinator_usage(argv[0]);
+        const char *arg = argv[++i];
+        switch (argv[i - 1][1]) {
+        case 'p': config.port = arg; break;
+        case 'n': config.settings.games = atoi(arg); break;
+        case 's': config.settings.first_seed = strtoull(arg, NULL, 0); break;
+        case 'd': config.settings.max_depth = atoi(arg); break;
+        case 'm': config.settings.trans_table_mb = atoi(arg); break;
+        case 'E': config.settings.engine = atoi(arg); break;
+        case 'P': config.settings.mcts_playouts = atoi(arg); break;
+        case 'r': config.record_fn = arg; break;
+        case 't': config.timeout_sec = atoi(arg); break;
+        default: coordinator_usage(argv[0]);
+        }
+    }
+    if ((int)config.settings.games <= 0 || config.timeout_sec <= FARM_HEARTBEAT_SEC)
+        coordinator_usage(argv[0]);
+
+#ifdef _WIN32
+    fprintf(stderr, "The coordinator needs BSD sockets, which this build does not support\n");
+    return 1;
+#else
+    coordinator_state state;
+    state.config = &config;
+    for (uint32_t i = 0; i < config.settings.games; i++)
+        state.queue.push_back(i);
+    state.done.assign(config.settings.games, false);
+    state.games_done = 0;
+    state.reassigned = 0;
+    state.workers_seen = 0;
+    memset(&state.summary, 0, sizeof(state.summary));
+    game_record_writer records;
+    if (config.record_fn) {
+        if (!records.open(config.record_fn))
+            return 1;
+        config.settings.record = 1;
+        state.summary.records = &records;
+        state.summary.records_ok = true;
+    }
+
+    // a worker hanging up shows up as a failed write instead
+    signal(SIGPIPE, SIG_IGN);
+
+    int listen_fd = listen_tcp(config.port);
+    if (listen_fd < 0)
+        return 1;
+    struct sockaddr_storage addr;
+    socklen_t addrlen = sizeof(addr);
+    getsockname(listen_fd, (struct sockaddr *)&addr, &addrlen);
+    fprintf(stderr, "Listening on %s for workers to play %u games\n", socket_name((struct sockaddr *)&addr, addrlen).c_str(), config.settings.games);
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    int next_id = 1;
+    while (true) {
+        {
+            std::lock_guard<std::mutex> guard(state.lock);
+            if (state.games_done == (int)config.settings.games)
+                break;
+        }
+        // wake up now and then to see whether the last game is in
+        struct pollfd pfd;
+        pfd.fd = listen_fd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, 200) <= 0)
+            continue;
+        addrlen = sizeof(addr);
+        int fd = accept(listen_fd, (struct sockaddr *)&addr, &addrlen);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            perror("accept");
+            break;
+        }
+        std::lock_guard<std::mutex> guard(state.lock);
+        farm_conn *conn = new farm_conn(fd, next_id++, socket_name((struct sockaddr *)&addr, addrlen));
+        state.conns.insert(conn);
+        std::thread(coordinate_worker, &state, conn).detach();
+    }
+    close(listen_fd);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    // tell the workers to go, and wait for their threads to let go of the state
+    std::unique_lock<std::mutex> guard(state.lock);
+    for (std::set<farm_conn *>::iterator it = state.conns.begin(); it != state.conns.end(); ++it) {
+        send_message((*it)->fd, FARM_DONE, NULL, 0);
+        shutdown((*it)->fd, SHUT_RDWR);
+    }
+    while (!state.conns.empty())
+        state.changed.wait(guard);
+
+    bool complete = state.games_done == (int)config.settings.games;
+    if (state.games_done)
+        print_selfplay_summary(state.summary, elapsed.count());
+    fprintf(stderr, "%d workers played %d games; %d games were reassigned\n", state.workers_seen, state.games_done, state.reassigned);
+    if (config.record_fn && !(records.close() && state.summary.records_ok))
+        return 1;
+    return complete ? 0 : 1;
+#endif
+}
+
+/* Worker */
+
+#ifndef _WIN32
+
+struct worker_state {
+    int fd;
+    farm_settings settings;
+    std::mutex lock; // guards the queue and the flags
+    std::condition_variable changed;
+    std::deque<uint32_t> queue; // games handed out by the coordinator, not started yet
+    bool stopping; // no more games will come
+    bool lost; // the coordinator went away before the end of the run
+    std::mutex write_lock;
+    int played;
+};
+
+static void worker_stop(worker_state *state, bool lost) {
+    std::lock_guard<std::mutex> guard(state->lock);
+    if (lost && !state->stopping) {
+        state->lost = true;
+        state->queue.clear();
+    }
+    state->stopping = true;
+    state->changed.notify_all();
+}
+
+static int worker_next_game(void *user) {
+    worker_state *state = (worker_state *)user;
+    std::unique_lock<std::mutex> guard(state->lock);
+    while (state->queue.empty() && !state->stopping)
+        state->changed.wait(guard);
+    if (state->queue.empty())
+        return -1;
+    int index = state->queue.front();
+    state->queue.pop_front();
+    return index;
+}
+
+static void worker_send_result(const selfplay_game &game, void *user) {
+    worker_state *state = (worker_state *)user;
+    farm_result result;
+    result.board = game.result.board;
+    result.index = game.index;
+    result.score = game.result.score;
+    result.maxrank = game.result.maxrank;
+    result.moves = game.result.moves;
+    result.elapsed_us = (uint32_t)(game.elapsed * 1e6);
+    result.plies = game.plies ? game.plies->size() : 0;
+    bool ok;
+    {
+        std::lock_guard<std::mutex> guard(state->write_lock);
+        ok = send_message(state->fd, FARM_RESULT, &result, sizeof(result),
+            result.plies ? &(*game.plies)[0] : NULL, result.plies * sizeof(game_record_ply));
+    }
+    if (ok)
+        state->played++;
+    else
+        worker_stop(state, true);
+}
+
+static void worker_read(worker_state *state) {
+    farm_header header;
+    farm_game game;
+    while (read_full(state->fd, &header, sizeof(header))) {
+        if (header.type == FARM_DONE && header.length == 0) {
+            worker_stop(state, false);
+            return;
+        }
+        if (header.type != FARM_GAME || header.length != sizeof(game) || !read_full(state->fd, &game, sizeof(game)) ||
+                game.index >= state->settings.games)
+            break;
+        std::lock_guard<std::mutex> guard(state->lock);
+        state->queue.push_back(game.index);
+        state->changed.notify_one();
+    }
+    worker_stop(state, true);
+}
+
+static void worker_heartbeat(worker_state *state) {
+    std::unique_lock<std::mutex> guard(state->lock);
+    while (!state->stopping) {
+        state->changed.wait_for(guard, std::chrono::seconds(FARM_HEARTBEAT_SEC));
+        if (state->stopping)
+            break;
+        guard.unlock();
+        {
+            std::lock_guard<std::mutex> write_guard(state->write_lock);
+            send_message(state->fd, FARM_HEARTBEAT, NULL, 0);
+        }
+        guard.lock();
+    }
+}
+
+static int connect_tcp(const char *address) {
+    std::string host(address), port;
+    // host, host:port, or [ipv6 address]:port
+    size_t colon = host.rfind(':'), bracket = host.rfind(']');
+    if (colon != std::string::npos && (bracket == std::string::npos ? host.find(':') == colon : colon > bracket)) {
+        port = host.substr(colon + 1);
+        host = host.substr(0, colon);
+    } else {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "%d", FARM_DEFAULT_PORT);
+        port = buf;
+    }
+    if (host.size() >= 2 && host[0] == '[' && host[host.size() - 1] == ']')
+        host = host.substr(1, host.size() - 2);
+
+    struct addrinfo hints, *addrs;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    int err = getaddrinfo(host.c_str(), port.c_str(), &hints, &addrs);
+    if (err) {
+        fprintf(stderr, "%s: %s\n", address, gai_strerror(err));
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo *addr = addrs; addr && fd < 0; addr = addr->ai_next) {
+        fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+        if (fd >= 0 && connect(fd, addr->ai_addr, addr->ai_addrlen) < 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addrs);
+    if (fd < 0)
+        perror(address);
+    return fd;
+}
+
+#endif /* _WIN32 */
+
+static void worker_usage(const char *argv0) {
+    fprintf(stderr,
+        "Usage: %s worker [-c host:port] [-j threads]\n"
+        "  -c host:port      coordinator to play games for (default localhost:2048)\n"
+        "  -j threads        games played concurrently, 0 = one per core (default 0)\n",
+        argv0);
+    exit(1);
+}
+
+int worker_main(int argc, char **argv) {
+    const char *address = "localhost";
+    int threads = 0;
+
+    for (int i = 2; i < argc; i++) {
+        if (i + 1 >= argc || argv[i][0] != '-' || strlen(argv[i]) != 2)
+            worker_usage(argv[0]);
+        const char *arg = argv[++i];
+        switch (argv[i - 1][1]) {
+        case 'c': address = arg; break;
+        case 'j': threads = atoi(arg); break;
+        default: worker_usage(argv[0]);
+        }
+    }
+    if (threads <= 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+#ifdef _WIN32
+    fprintf(stderr, "The worker needs BSD sockets, which this build does not support\n");
+    return 1;
+#else
+    signal(SIGPIPE, SIG_IGN);
+
+    worker_state state;
+    state.fd = connect_tcp(address);
+    if (state.fd < 0)
+        return 1;
+    set_nodelay(state.fd);
+    state.stopping = false;
+    state.lost = false;
+    state.played = 0;
+
+    farm_hello hello;
+    memcpy(hello.magic, FARM_MAGIC, sizeof(hello.magic));
+    hello.version = FARM_VERSION;
+    hello.threads = threads;
+    if (!send_message(state.fd, FARM_HELLO, &hello, sizeof(hello)) ||
+            !read_message(state.fd, FARM_SETTINGS, &state.settings, sizeof(state.settings))) {
+        fprintf(stderr, "%s: no settings from the coordinator; is it one of this version?\n", address);
+        close(state.fd);
+        return 1;
+    }
+
+    selfplay_config config;
+    config.games = state.settings.games;
+    config.first_seed = state.settings.first_seed;
+    config.threads = threads;
+    config.max_depth = state.settings.max_depth;
+    config.trans_table_mb = state.settings.trans_table_mb;
+    config.engine = state.settings.engine;
+    config.mcts_playouts = state.settings.mcts_playouts;
+    config.record = state.settings.record != 0;
+    config.next = worker_next_game;
+    config.next_user = &state;
+    fprintf(stderr, "Playing %u-game run from %s on %d threads\n", state.settings.games, address, threads);
+
+    std::thread reader(worker_read, &state);
+    std::thread heartbeat(worker_heartbeat, &state);
+    run_selfplay(config, worker_send_result, &state);
+    worker_stop(&state, false);
+    shutdown(state.fd, SHUT_RDWR);
+    reader.join();
+    heartbeat.join();
+    close(state.fd);
+
+    fprintf(stderr, "Played %d games%s\n", state.played, state.lost ? "; lost the coordinator" : "");
+    return state.lost ? 1 : 0;
+#endif
+}
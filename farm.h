@@ -0,0 +1,87 @@
+#ifndef FARM_H
+#define FARM_H
+
+#include <stdint.h>
+
+#include "2048.h"
+
+/* Distributed self-play: one coordinator, any number of workers on any number of machines.
+ *
+ * `bin/2048 coordinator` owns the run: the seeds (game i uses first_seed + i, as in
+ * `bin/2048 selfplay`), the engine settings, the results and the game record file. It
+ * listens on a TCP port, and `bin/2048 worker` processes connect to it, receive the
+ * settings, and play the games it hands them on all of their cores with run_selfplay.
+ * Each finished game is sent back as soon as it ends, with its plies if the run is
+ * recorded, and the coordinator prints it and gives the worker another game.
+ *
+ * A worker is kept one game ahead of its threads, so it never waits for the network. A
+ * worker that disconnects, or that has not been heard from for the coordinator's timeout
+ * (workers send a heartbeat every few seconds, however long their games take), is dropped,
+ * and the games it held go back to the front of the queue for the other workers. Since a
+ * game only depends on its seed, a reassigned game is played exactly as the lost one would
+ * have been, and the run's results do not depend on which workers played it. Workers may
+ * join at any time; the coordinator exits, and tells the workers to, once every game is in.
+ *
+ * Messages are a farm_header followed by `length` bytes of body, in native byte order
+ * (every machine involved must share it, which the hello's magic checks):
+ *
+ *   worker -> coordinator   FARM_HELLO, then FARM_RESULT and FARM_HEARTBEAT
+ *   coordinator -> worker   FARM_SETTINGS, then FARM_GAME, and FARM_DONE at the end
+ */
+
+static const int FARM_VERSION = 1;
+static const int FARM_DEFAULT_PORT = 2048;
+static const int FARM_HEARTBEAT_SEC = 5;
+
+enum {
+    FARM_HELLO = 1, // farm_hello
+    FARM_SETTINGS = 2, // farm_settings
+    FARM_GAME = 3, // farm_game: play this game
+    FARM_RESULT = 4, // farm_result, then result.plies game_record_ply
+    FARM_HEARTBEAT = 5, // no body
+    FARM_DONE = 6, // no body: every game is in, disconnect
+};
+
+struct farm_header {
+    uint32_t type; // FARM_*
+    uint32_t length; // of the body
+};
+
+struct farm_hello {
+    char magic[8]; // "2048FARM"
+    uint32_t version; // FARM_VERSION
+    uint32_t threads; // games the worker plays at once
+};
+
+struct farm_settings {
+    uint64_t first_seed;
+    uint32_t games; // in the run
+    int32_t max_depth;
+    uint32_t trans_table_mb;
+    int32_t engine; // SEARCH_ENGINE_*
+    uint32_t mcts_playouts;
+    uint32_t record; // send the plies of every game
+};
+
+struct farm_game {
+    uint32_t index;
+};
+
+struct farm_result {
+    board_t board; // final position
+    uint32_t index;
+    uint32_t score;
+    int32_t maxrank;
+    int32_t moves;
+    uint32_t elapsed_us;
+    uint32_t plies;
+};
+
+/* `bin/2048 coordinator ...`: hand out the games of a run to workers, stream one JSON line
+ * per finished game, then a summary line. */
+int coordinator_main(int argc, char **argv);
+
+/* `bin/2048 worker ...`: play games for a coordinator until it has no more. */
+int worker_main(int argc, char **argv);
+
+#endif /* FARM_H */
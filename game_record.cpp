@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "game_record.h"
+
+static const char GAME_RECORD_MAGIC[8] = {'2', '0', '4', '8', 'G', 'R', 'E', 'C'};
+
+void game_recorder::begin(uint32_t game_number) {
+    game = game_number;
+    recorded.clear();
+}
+
+// the tile the game placed after the last ply, found by comparing with the next position
+void game_recorder::place_tile(board_t board) {
+    if (recorded.empty())
+        return;
+    game_record_ply &last = recorded.back();
+    board_t placed = board ^ execute_move(last.move, last.board);
+    for (int cell = 0; cell < 16; cell++) {
+        if ((placed >> (4 * cell)) & 0xf) {
+            last.cell = cell;
+            last.tile = (placed >> (4 * cell)) & 0xf;
+            break;
+        }
+    }
+}
+
+void game_recorder::move(board_t board, int move) {
+    place_tile(board);
+    if (move < 0)
+        return;
+    game_record_ply ply;
+    ply.board = board;
+    ply.game = game;
+    ply.move = move;
+    ply.tile = 0;
+    ply.cell = 0;
+    ply.flags = recorded.empty() ? GAME_RECORD_FIRST_PLY : 0;
+    recorded.push_back(ply);
+}
+
+void game_recorder::end(board_t board) {
+    place_tile(board);
+}
+
+bool game_record_writer::open(const char *fn) {
+    close();
+    path = fn;
+    f = fopen(path, "wb");
+    if (!f) {
+        perror(path);
+        return false;
+    }
+    game_record_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, GAME_RECORD_MAGIC, sizeof(header.magic));
+    header.version = GAME_RECORD_VERSION;
+    if (fwrite(&header, sizeof(header), 1, f) != 1) {
+        fprintf(stderr, "%s: write failed\n", path);
+        return false;
+    }
+    return true;
+}
+
+bool game_record_writer::write(const std::vector<game_record_ply> &plies) {
+    if (plies.empty())
+        return true;
+    if (fwrite(&plies[0], sizeof(plies[0]), plies.size(), f) != plies.size()) {
+        fprintf(stderr, "%s: write failed\n", path);
+        return false;
+    }
+    return true;
+}
+
+bool game_record_writer::close() {
+    if (!f)
+        return true;
+    bool ok = fclose(f) == 0;
+    f = NULL;
+    if (!ok)
+        fprintf(stderr, "%s: write failed\n", path);
+    return ok;
+}
+
+game_record_file *game_record_file::load(const char *path) {
+    game_record_file *records = new game_record_file();
+    if (!records->file.open(path)) {
+        delete records;
+        return NULL;
+    }
+    const game_record_header *header = (const game_record_header *)records->file.data;
+    if (records->file.size < sizeof(*header) || memcmp(header->magic, GAME_RECORD_MAGIC, sizeof(GAME_RECORD_MAGIC)) ||
+            header->version != GAME_RECORD_VERSION) {
+        fprintf(stderr, "%s: not a game record file, or not version %d\n", path, GAME_RECORD_VERSION);
+        delete records;
+        return NULL;
+    }
+    records->plies = (const game_record_ply *)(header + 1);
+    // a partly written last ply is ignored
+    records->count = (records->file.size - sizeof(*header)) / sizeof(game_record_ply);
+    return records;
+}
@@ -0,0 +1,109 @@
+#ifndef GAME_RECORD_H
+#define GAME_RECORD_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+#include "2048.h"
+#include "mapped_file.h"
+
+/* Game records: every move of a set of games, in a compact binary file.
+ *
+ * File format (native byte order): a game_record_header, then one game_record_ply per move
+ * of every game, one game after another. A ply holds the position before the move, the
+ * move, and the tile the game placed after it, so a game's final position is its last
+ * ply's board after that move and tile. Games are appended as they finish, so the plies of
+ * a game are contiguous and a file cut short by a killed writer is readable up to its last
+ * whole ply. `bin/2048 selfplay -r` writes these files, and `bin/2048 replay` reads them.
+ */
+
+static const int GAME_RECORD_VERSION = 1;
+
+enum {
+    GAME_RECORD_FIRST_PLY = 1, // the ply starts a game
+};
+
+struct game_record_header {
+    char magic[8]; // "2048GREC"
+    uint32_t version;
+    uint32_t reserved;
+};
+
+struct game_record_ply {
+    board_t board; // position before the move
+    uint32_t game; // number of the game, as the writer counts them (selfplay: the game's index)
+    uint8_t move;
+    uint8_t tile; // rank of the tile placed after the move: 1 (a 2) or 2 (a 4)
+    uint8_t cell; // cell it was placed in, 4 * row + col, as in board_t
+    uint8_t flags; // GAME_RECORD_*
+};
+
+/* Collects the plies of one game from the positions it goes through. */
+class game_recorder {
+public:
+    game_recorder() : game(0) {
+    }
+
+    void begin(uint32_t game);
+
+    /* The game reached `board` and `move` was chosen in it (-1: none, the game is over). */
+    void move(board_t board, int move);
+
+    /* The game ended in `board`. */
+    void end(board_t board);
+
+    const std::vector<game_record_ply> &plies() const {
+        return recorded;
+    }
+
+private:
+    void place_tile(board_t board);
+
+    uint32_t game;
+    std::vector<game_record_ply> recorded;
+};
+
+class game_record_writer {
+public:
+    game_record_writer() : f(NULL), path(NULL) {
+    }
+
+    ~game_record_writer() {
+        close();
+    }
+
+    /* Create (or truncate) `path` and write the header; prints why and returns false on failure. */
+    bool open(const char *path);
+
+    bool write(const std::vector<game_record_ply> &plies);
+
+    bool close();
+
+private:
+    FILE *f;
+    const char *path;
+
+    game_record_writer(const game_record_writer &);
+    game_record_writer &operator=(const game_record_writer &);
+};
+
+class game_record_file {
+public:
+    /* Map a record file. Returns NULL, with the reason on stderr, if it is not one. */
+    static game_record_file *load(const char *path);
+
+    const game_record_ply *plies;
+    uint64_t count;
+
+private:
+    game_record_file() : plies(NULL), count(0) {
+    }
+
+    mapped_file file;
+
+    game_record_file(const game_record_file &);
+    game_record_file &operator=(const game_record_file &);
+};
+
+#endif /* GAME_RECORD_H */
@@ -0,0 +1,92 @@
+/* Build-time table generator.
+ *
+ * Writes the move and score tables used by 2048.cpp as C++ array definitions to stdout
+ * (the build redirects it to bin/tables.inc), in both the default and the compact
+ * layout. Floats are printed with 9 significant digits, which reproduces every value bit
+ * for bit. */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "tables.h"
+
+static void print_row_table(const char *decl, const row_t *table, int n) {
+    printf("%s = {", decl);
+    for (int i = 0; i < n; ++i)
+        printf("%s0x%x,", (i % 16) ? "" : "\n", table[i]);
+    printf("\n};\n\n");
+}
+
+static void print_board_table(const char *decl, const board_t *table, int n) {
+    printf("%s = {", decl);
+    for (int i = 0; i < n; ++i)
+        printf("%s0x%llxULL,", (i % 8) ? "" : "\n", (unsigned long long)table[i]);
+    printf("\n};\n\n");
+}
+
+// a float literal that reads back as exactly `x`
+static void print_float(float x) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.9g", x);
+    printf("%s%sf", buf, strpbrk(buf, ".e") ? "" : ".0");
+}
+
+static void print_float_table(const char *decl, const float *table, int n) {
+    printf("%s = {", decl);
+    for (int i = 0; i < n; ++i) {
+        printf("%s", (i % 8) ? "" : "\n");
+        print_float(table[i]);
+        printf(",");
+    }
+    printf("\n};\n\n");
+}
+
+static void print_row_entry_table(const char *decl, const row_t *left, const row_t *right, const float *heur, int n) {
+    printf("%s = {", decl);
+    for (int i = 0; i < n; ++i) {
+        printf("%s{0x%x, 0x%x, ", (i % 4) ? " " : "\n", left[i], right[i]);
+        print_float(heur[i]);
+        printf("},");
+    }
+    printf("\n};\n\n");
+}
+
+static row_t row_left_table [65536 + 1];
+static row_t row_right_table[65536 + 1];
+static board_t col_up_table[65536];
+static board_t col_down_table[65536];
+static float heur_score_table[65536];
+static float score_table[65536];
+
+int main() {
+    for (unsigned row = 0; row < 65536; ++row) {
+        score_table[row] = row_score(row);
+        heur_score_table[row] = row_heur_score(row, DEFAULT_HEUR_WEIGHTS);
+
+        row_t result = row_move_left(row);
+        row_t rev_result = reverse_row(result);
+        unsigned rev_row = reverse_row(row);
+
+        row_left_table [    row] =                row  ^                result;
+        row_right_table[rev_row] =            rev_row  ^            rev_result;
+        col_up_table   [    row] = unpack_col(    row) ^ unpack_col(    result);
+        col_down_table [rev_row] = unpack_col(rev_row) ^ unpack_col(rev_result);
+    }
+    float heur_max = *std::max_element(heur_score_table, heur_score_table + 65536);
+
+    printf("/* Generated by gentables.cpp; do not edit. */\n\n");
+    printf("#ifdef COMPACT_TABLES\n\n");
+    print_row_entry_table("static const row_entry_t row_table[65536]", row_left_table, row_right_table, heur_score_table, 65536);
+    printf("#else\n\n");
+    print_row_table("static const row_t row_left_table [65536 + 1]", row_left_table, 65536 + 1);
+    print_row_table("static const row_t row_right_table[65536 + 1]", row_right_table, 65536 + 1);
+    print_board_table("static const board_t col_up_table[65536]", col_up_table, 65536);
+    print_board_table("static const board_t col_down_table[65536]", col_down_table, 65536);
+    print_float_table("static const float heur_score_table[65536]", heur_score_table, 65536);
+    printf("#endif\n\n");
+    print_float_table("static const float score_table[65536]", score_table, 65536);
+    printf("static const float heur_score_upper_bound = ");
+    print_float(heur_score_bound(heur_max));
+    printf(";\n");
+    return 0;
+}
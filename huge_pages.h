@@ -0,0 +1,145 @@
+#ifndef HUGE_PAGES_H
+#define HUGE_PAGES_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "2048.h"
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+/* Large zeroed buffers that can live in 2 MB huge pages.
+ *
+ * The transposition table and the MCTS node pool are read at random, so with 4 KB pages
+ * nearly every probe also misses the TLB. With huge pages requested, a buffer is first
+ * mapped from the explicit huge page pool (MAP_HUGETLB), which only works when the
+ * administrator has reserved pages in /proc/sys/vm/nr_hugepages; failing that, it is
+ * mapped 2 MB-aligned and marked MADV_HUGEPAGE, so that transparent huge pages back it if
+ * the kernel has them enabled and can find free 2 MB blocks. Without huge pages (or off
+ * Linux) it comes from calloc, as before. Either way the memory is zero without being
+ * written: nothing touches a page before the search does, so each page is placed on the
+ * NUMA node of the search thread that first writes to it.
+ */
+
+static const size_t HUGE_PAGE_SIZE = size_t(2) << 20;
+
+class huge_buffer {
+public:
+    huge_buffer() : data(NULL), size(0), pages(HUGE_PAGES_NONE), raw(NULL), mapped(0) {
+    }
+
+    ~huge_buffer() {
+        release();
+    }
+
+    /* Allocate `bytes` of zeroed memory aligned to 64 bytes, in huge pages if `huge` and
+     * they can be had. Returns false if there is no memory at all. */
+    bool allocate(size_t bytes, bool huge) {
+        release();
+        size = bytes;
+#if defined(__linux__) && defined(MAP_ANONYMOUS)
+        if (huge) {
+            size_t len = (bytes + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+#ifdef MAP_HUGETLB
+            void *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (p != MAP_FAILED) {
+                data = raw = p;
+                mapped = len;
+                pages = HUGE_PAGES_EXPLICIT;
+                return true;
+            }
+#endif
+            // over-map by one huge page, and trim the ends to align the buffer to one
+            char *p2 = (char *)mmap(NULL, len + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p2 != MAP_FAILED) {
+                char *aligned = (char *)(((uintptr_t)p2 + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+                if (aligned > p2)
+                    munmap(p2, aligned - p2);
+                if (aligned + len < p2 + len + HUGE_PAGE_SIZE)
+                    munmap(aligned + len, p2 + len + HUGE_PAGE_SIZE - (aligned + len));
+                data = raw = aligned;
+                mapped = len;
+#ifdef MADV_HUGEPAGE
+                if (madvise(aligned, len, MADV_HUGEPAGE) == 0 && transparent_huge_pages_enabled())
+                    pages = HUGE_PAGES_TRANSPARENT;
+#endif
+                return true;
+            }
+        }
+#else
+        (void)huge;
+#endif
+        raw = calloc(bytes + 63, 1);
+        if (!raw)
+            return false;
+        data = (void *)(((uintptr_t)raw + 63) & ~(uintptr_t)63);
+        return true;
+    }
+
+    void release() {
+#if defined(__linux__) && defined(MAP_ANONYMOUS)
+        if (mapped)
+            munmap(raw, mapped);
+        else
+#endif
+            free(raw);
+        data = raw = NULL;
+        size = mapped = 0;
+        pages = HUGE_PAGES_NONE;
+    }
+
+    /* Bytes of the buffer that are backed by huge pages right now. Transparent huge pages are
+     * counted from /proc/self/smaps, which takes a while: do not call this per search. */
+    size_t huge_bytes() const {
+        if (pages == HUGE_PAGES_EXPLICIT)
+            return size;
+        if (pages != HUGE_PAGES_TRANSPARENT)
+            return 0;
+        size_t bytes = 0;
+#if defined(__linux__)
+        FILE *f = fopen("/proc/self/smaps", "r");
+        if (!f)
+            return 0;
+        char line[256];
+        bool in_buffer = false;
+        while (fgets(line, sizeof(line), f)) {
+            unsigned long long start, end, kb;
+            if (sscanf(line, "%llx-%llx ", &start, &end) == 2 && strchr(line, '-') < strchr(line, ' ')) {
+                // the buffer's mapping may have been merged with neighbouring ones
+                in_buffer = start < (uintptr_t)raw + mapped && end > (uintptr_t)raw;
+            } else if (in_buffer && sscanf(line, "AnonHugePages: %llu kB", &kb) == 1) {
+                bytes += kb << 10;
+            }
+        }
+        fclose(f);
+#endif
+        return bytes < size ? bytes : size;
+    }
+
+    void *data;
+    size_t size;
+    int pages; // HUGE_PAGES_*: what the buffer got
+
+private:
+    void *raw;
+    size_t mapped; // length of the mapping, or 0 if the buffer came from calloc
+
+    static bool transparent_huge_pages_enabled() {
+        FILE *f = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+        if (!f)
+            return false;
+        char mode[128] = "";
+        bool enabled = fgets(mode, sizeof(mode), f) && !strstr(mode, "[never]");
+        fclose(f);
+        return enabled;
+    }
+
+    huge_buffer(const huge_buffer &);
+    huge_buffer &operator=(const huge_buffer &);
+};
+
+#endif /* HUGE_PAGES_H */
@@ -0,0 +1,52 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "2048.h"
+#include "build_move_cache.h"
+#include "farm.h"
+#include "replay.h"
+#include "selfplay.h"
+#include "server.h"
+#include "train_ntuple.h"
+
+static void usage(const char *argv0) {
+    fprintf(stderr,
+        "Usage: %s                         watch the AI play one game\n"
+        "       %s selfplay ...            play many seeded games in parallel\n"
+        "       %s sweep ...               compare heuristic weight vectors over the same games\n"
+        "       %s train-ntuple ...        train an n-tuple network evaluator by TD learning\n"
+        "       %s build-move-cache ...    search frequent positions ahead of time into a move cache\n"
+        "       %s serve ...               answer search requests from many games over a socket or stdin/stdout\n"
+        "       %s replay ...              re-search the games of a record file and report the moves that lose score\n"
+        "       %s coordinator ...         hand out the games of a self-play run to workers over TCP\n"
+        "       %s worker ...              play self-play games for a coordinator\n",
+        argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0, argv0);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        set_search_option(NULL, SEARCH_OPT_VERBOSE, 1);
+        play_game(find_best_move);
+        return 0;
+    }
+
+    if (!strcmp(argv[1], "selfplay"))
+        return selfplay_main(argc, argv);
+    if (!strcmp(argv[1], "sweep"))
+        return sweep_main(argc, argv);
+    if (!strcmp(argv[1], "train-ntuple"))
+        return train_ntuple_main(argc, argv);
+    if (!strcmp(argv[1], "build-move-cache"))
+        return build_move_cache_main(argc, argv);
+    if (!strcmp(argv[1], "replay"))
+        return replay_main(argc, argv);
+    if (!strcmp(argv[1], "serve"))
+        return server_main(argc, argv);
+    if (!strcmp(argv[1], "coordinator"))
+        return coordinator_main(argc, argv);
+    if (!strcmp(argv[1], "worker"))
+        return worker_main(argc, argv);
+
+    usage(argv[0]);
+    return 1;
+}
@@ -1,3 +1,8 @@
 @mkdir bin
-cl /W1 /O2 /Gd /MD /D _WINDLL /EHsc /nologo 2048.cpp /Fobin\2048.obj /link /OUT:bin\2048.exe
-cl /nologo bin\2048.obj /link /DLL /OUT:bin\2048.dll
+cl /W1 /O2 /EHsc /nologo gentables.cpp /Fobin\ /Febin\gentables.exe
+bin\gentables.exe > bin\tables.inc
+cl /W1 /O2 /Gd /MD /D _WINDLL /EHsc /nologo /c 2048.cpp move_cache.cpp ntuple.cpp thread_pool.cpp main.cpp build_move_cache.cpp farm.cpp game_record.cpp replay.cpp selfplay.cpp server.cpp train_ntuple.cpp bench.cpp bench_kernels.cpp /Fobin\
+cl /nologo bin\main.obj bin\build_move_cache.obj bin\farm.obj bin\game_record.obj bin\replay.obj bin\selfplay.obj bin\server.obj bin\train_ntuple.obj bin\2048.obj bin\move_cache.obj bin\ntuple.obj bin\thread_pool.obj /link /OUT:bin\2048.exe
+cl /nologo bin\bench.obj bin\2048.obj bin\move_cache.obj bin\ntuple.obj bin\thread_pool.obj /link /OUT:bin\2048-bench.exe
+cl /nologo bin\bench_kernels.obj bin\game_record.obj bin\2048.obj bin\move_cache.obj bin\ntuple.obj bin\thread_pool.obj /link /OUT:bin\2048-bench-kernels.exe
+cl /nologo bin\2048.obj bin\move_cache.obj bin\ntuple.obj bin\thread_pool.obj /link /DLL /OUT:bin\2048.dll
@@ -0,0 +1,100 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/* A whole file mapped read-only into memory.
+ *
+ * Large tables are mapped rather than read: the pages are only read from disk once a
+ * search touches them, and every process mapping the same file shares one copy of them
+ * in the page cache.
+ */
+class mapped_file {
+public:
+    mapped_file() : data(NULL), size(0) {
+    }
+
+    ~mapped_file() {
+        close();
+    }
+
+    /* Map `path`; on failure, prints why to stderr and returns false. */
+    bool open(const char *path) {
+        close();
+#ifdef _WIN32
+        HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE) {
+            fprintf(stderr, "%s: cannot open file\n", path);
+            return false;
+        }
+        LARGE_INTEGER file_size;
+        HANDLE mapping = NULL;
+        if (GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0)
+            mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        CloseHandle(file);
+        if (!mapping) {
+            fprintf(stderr, "%s: cannot map file\n", path);
+            return false;
+        }
+        data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);
+        if (!data) {
+            fprintf(stderr, "%s: cannot map file\n", path);
+            return false;
+        }
+        size = (size_t)file_size.QuadPart;
+#else
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) {
+            perror(path);
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) < 0 || st.st_size == 0) {
+            fprintf(stderr, "%s: empty or unreadable file\n", path);
+            ::close(fd);
+            return false;
+        }
+        void *p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) {
+            perror(path);
+            return false;
+        }
+        data = p;
+        size = st.st_size;
+#endif
+        return true;
+    }
+
+    void close() {
+        if (!data)
+            return;
+#ifdef _WIN32
+        UnmapViewOfFile(data);
+#else
+        munmap((void *)data, size);
+#endif
+        data = NULL;
+        size = 0;
+    }
+
+    const void *data;
+    size_t size;
+
+private:
+    mapped_file(const mapped_file &);
+    mapped_file &operator=(const mapped_file &);
+};
+
+#endif /* MAPPED_FILE_H */
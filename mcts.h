@@ -0,0 +1,99 @@
+#ifndef MCTS_H
+#define MCTS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+
+#include "2048.h"
+#include "huge_pages.h"
+
+/* Node pool of the Monte Carlo tree search (SEARCH_ENGINE_MCTS, see 2048.cpp).
+ *
+ * The tree alternates between positions, where a move is chosen, and afterstates, the
+ * positions right after a move and before the tile is placed. A position's four
+ * afterstates are allocated together, one per move (those of illegal moves stay unused),
+ * and an afterstate keeps a list of the positions its tile placements have led to so far.
+ *
+ * Nodes live in one preallocated array and are named by their index; index 0 means none.
+ * All threads of a search grow the same tree without locks: nodes are bump-allocated
+ * with an atomic counter and filled in before being linked in with a compare-and-swap, so
+ * a thread that loses a race only wastes its nodes. Once the pool is full, the tree stops
+ * growing and the search goes on with playouts from its leaves.
+ */
+
+struct mcts_node {
+    board_t board;
+    std::atomic<uint32_t> visits; // playouts through the node, counted when they start
+    std::atomic<uint32_t> children; // position: its first afterstate; afterstate: the last position found after it
+    std::atomic<uint32_t> next; // the position found before this one after the same afterstate
+    std::atomic<uint64_t> total; // sum of the results of the playouts through the node that have finished
+    int legal; // position: mask of its legal moves
+};
+
+class mcts_tree {
+public:
+    /* With `huge_pages`, the pool goes in huge pages if it can (see huge_pages.h). */
+    mcts_tree(uint32_t capacity, bool huge_pages) : capacity(capacity), used(1) {
+        // a node is only used once alloc() has set every field, so the zeroed buffer is not touched here
+        if (!memory.allocate(size_t(capacity) * sizeof(mcts_node), huge_pages)) {
+            fprintf(stderr, "Unable to allocate %lu-byte MCTS node pool\n", (unsigned long)(size_t(capacity) * sizeof(mcts_node)));
+            abort();
+        }
+        nodes = (mcts_node *)memory.data;
+    }
+
+    /* Drop every node. */
+    void clear() {
+        used = 1;
+    }
+
+    /* Allocate n consecutive zeroed nodes; returns the first, or 0 if the pool is full. */
+    uint32_t alloc(uint32_t n) {
+        uint32_t first = used.fetch_add(n, std::memory_order_relaxed);
+        if (first + n > capacity || first + n < first) {
+            used.store(capacity, std::memory_order_relaxed);
+            return 0;
+        }
+        for (uint32_t i = first; i < first + n; i++) {
+            nodes[i].board = 0;
+            nodes[i].visits.store(0, std::memory_order_relaxed);
+            nodes[i].children.store(0, std::memory_order_relaxed);
+            nodes[i].next.store(0, std::memory_order_relaxed);
+            nodes[i].total.store(0, std::memory_order_relaxed);
+            nodes[i].legal = 0;
+        }
+        return first;
+    }
+
+    mcts_node &operator[](uint32_t index) {
+        return nodes[index];
+    }
+
+    /* HUGE_PAGES_*: what the pool got. */
+    int pages() const {
+        return memory.pages;
+    }
+
+    size_t huge_bytes() const {
+        return memory.huge_bytes();
+    }
+
+    /* Nodes in use. */
+    uint32_t size() const {
+        return std::min(used.load(std::memory_order_relaxed), capacity) - 1;
+    }
+
+private:
+    huge_buffer memory;
+    mcts_node *nodes;
+    uint32_t capacity;
+    std::atomic<uint32_t> used;
+
+    mcts_tree(const mcts_tree &);
+    mcts_tree &operator=(const mcts_tree &);
+};
+
+#endif /* MCTS_H */
@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+#include "move_cache.h"
+
+static const char MOVE_CACHE_MAGIC[8] = {'2', '0', '4', '8', 'M', 'O', 'V', 'C'};
+
+static bool entry_less(const move_cache_entry &a, const move_cache_entry &b) {
+    return a.board < b.board;
+}
+
+move_cache *move_cache::load(const char *path) {
+    move_cache *cache = new move_cache();
+    if (!cache->file.open(path)) {
+        delete cache;
+        return NULL;
+    }
+    const move_cache_header *header = (const move_cache_header *)cache->file.data;
+    if (cache->file.size < sizeof(*header) || memcmp(header->magic, MOVE_CACHE_MAGIC, sizeof(MOVE_CACHE_MAGIC)) ||
+            header->version != MOVE_CACHE_VERSION) {
+        fprintf(stderr, "%s: not a move cache, or not version %d\n", path, MOVE_CACHE_VERSION);
+        delete cache;
+        return NULL;
+    }
+    // compare the count with what the file holds by dividing, which cannot overflow as multiplying can
+    size_t entries = (cache->file.size - sizeof(*header)) / sizeof(move_cache_entry);
+    if (header->count != entries || (cache->file.size - sizeof(*header)) % sizeof(move_cache_entry)) {
+        fprintf(stderr, "%s: truncated or corrupt move cache\n", path);
+        delete cache;
+        return NULL;
+    }
+    cache->entries = (const move_cache_entry *)(header + 1);
+    cache->count = header->count;
+    return cache;
+}
+
+bool move_cache::write(const char *path, std::vector<move_cache_entry> &entries, int max_depth) {
+    std::sort(entries.begin(), entries.end(), entry_less);
+
+    move_cache_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, MOVE_CACHE_MAGIC, sizeof(header.magic));
+    header.version = MOVE_CACHE_VERSION;
+    header.max_depth = max_depth;
+    header.count = entries.size();
+
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        perror(path);
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+        (entries.empty() || fwrite(&entries[0], sizeof(entries[0]), entries.size(), f) == entries.size());
+    ok = (fclose(f) == 0) && ok;
+    if (!ok)
+        fprintf(stderr, "%s: write failed\n", path);
+    return ok;
+}
+
+const move_cache_entry *move_cache::lookup(board_t board) const {
+    move_cache_entry key;
+    key.board = board;
+    const move_cache_entry *it = std::lower_bound(entries, entries + count, key, entry_less);
+    if (it == entries + count || it->board != board)
+        return NULL;
+    return it;
+}
@@ -0,0 +1,60 @@
+#ifndef MOVE_CACHE_H
+#define MOVE_CACHE_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "2048.h"
+#include "mapped_file.h"
+
+/* Move cache: the root scores of positions searched ahead of time, in a file that a
+ * search context maps read-only (set_move_cache) and consults before searching.
+ *
+ * File format (native byte order): a move_cache_header, then `count` move_cache_entry
+ * records sorted by board, so a lookup is a binary search over the mapped file and opening
+ * one costs nothing but the mapping. Boards are stored as they are, not canonicalized.
+ * `bin/2048 build-move-cache` writes these files.
+ */
+
+static const int MOVE_CACHE_VERSION = 1;
+
+struct move_cache_header {
+    char magic[8]; // "2048MOVC"
+    uint32_t version;
+    int32_t max_depth; // depth cap of the searches that filled the cache, 0 for none
+    uint64_t count;
+    uint64_t reserved;
+};
+
+struct move_cache_entry {
+    board_t board;
+    float scores[4]; // score_toplevel_move of each move; 0 for a move that changes nothing
+};
+
+class move_cache {
+public:
+    /* Map a cache file. Returns NULL, with the reason on stderr, if it is not one. */
+    static move_cache *load(const char *path);
+
+    /* Sort `entries` by board and write them to `path` as a cache file. */
+    static bool write(const char *path, std::vector<move_cache_entry> &entries, int max_depth);
+
+    const move_cache_entry *lookup(board_t board) const;
+
+    uint64_t size() const {
+        return count;
+    }
+
+private:
+    move_cache() : entries(NULL), count(0) {
+    }
+
+    mapped_file file;
+    const move_cache_entry *entries;
+    uint64_t count;
+
+    move_cache(const move_cache &);
+    move_cache &operator=(const move_cache &);
+};
+
+#endif /* MOVE_CACHE_H */
@@ -0,0 +1,248 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+#include "ntuple.h"
+
+static const char NTUPLE_MAGIC[8] = {'2', '0', '4', '8', 'N', 'T', 'U', 'P'};
+
+struct ntuple_layout {
+    const char *name;
+    int ntuples;
+    int ncells;
+    uint8_t cells[NTUPLE_MAX_TUPLES][NTUPLE_MAX_CELLS];
+};
+
+static const ntuple_layout ntuple_layouts[] = {
+    {"4", 5, 4, {
+        {0, 1, 2, 3}, {4, 5, 6, 7},
+        {0, 1, 4, 5}, {1, 2, 5, 6}, {5, 6, 9, 10},
+    }},
+    {"6", 4, 6, {
+        {0, 1, 2, 3, 4, 5}, {4, 5, 6, 7, 8, 9},
+        {0, 1, 2, 4, 5, 6}, {4, 5, 6, 8, 9, 10},
+    }},
+};
+
+// the cell that `cell` moves to under symmetry `sym` (0..7) of the board
+static int map_cell(int cell, int sym) {
+    int row = cell / 4, col = cell % 4;
+    if (sym & 1)
+        col = 3 - col;
+    if (sym & 2)
+        row = 3 - row;
+    if (sym & 4)
+        std::swap(row, col);
+    return 4 * row + col;
+}
+
+static size_t tuple_weights(int ncells) {
+    return size_t(1) << (4 * ncells);
+}
+
+static float max_weight(const float *w, size_t n) {
+    return *std::max_element(w, w + n);
+}
+
+ntuple_network::ntuple_network() : weights(NULL), owned_weights(NULL), total_weights(0), nexpanded(0) {
+    memset(&header, 0, sizeof(header));
+}
+
+ntuple_network::~ntuple_network() {
+    free(owned_weights);
+}
+
+/* Check the header, and size the weights that follow it. */
+bool ntuple_network::init(const ntuple_file_header &h, const char *path) {
+    if (memcmp(h.magic, NTUPLE_MAGIC, sizeof(NTUPLE_MAGIC)) || h.version != NTUPLE_VERSION) {
+        fprintf(stderr, "%s: not an n-tuple network, or not version %d\n", path, NTUPLE_VERSION);
+        return false;
+    }
+    if (h.ntuples < 1 || h.ntuples > (uint32_t)NTUPLE_MAX_TUPLES) {
+        fprintf(stderr, "%s: bad tuple count %u\n", path, h.ntuples);
+        return false;
+    }
+    header = h;
+    total_weights = 0;
+    for (unsigned t = 0; t < header.ntuples; t++) {
+        if (header.ncells[t] < 1 || header.ncells[t] > NTUPLE_MAX_CELLS) {
+            fprintf(stderr, "%s: tuple %u has %d cells\n", path, t, header.ncells[t]);
+            return false;
+        }
+        for (int i = 0; i < header.ncells[t]; i++) {
+            if (header.cells[t][i] >= 16) {
+                fprintf(stderr, "%s: tuple %u has bad cell %d\n", path, t, header.cells[t][i]);
+                return false;
+            }
+        }
+        total_weights += tuple_weights(header.ncells[t]);
+    }
+    return true;
+}
+
+ntuple_network *ntuple_network::create(const char *layout_name) {
+    const ntuple_layout *layout = NULL;
+    for (size_t i = 0; i < sizeof(ntuple_layouts) / sizeof(ntuple_layouts[0]); i++) {
+        if (!strcmp(ntuple_layouts[i].name, layout_name))
+            layout = &ntuple_layouts[i];
+    }
+    if (!layout)
+        return NULL;
+
+    ntuple_file_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, NTUPLE_MAGIC, sizeof(h.magic));
+    h.version = NTUPLE_VERSION;
+    h.ntuples = layout->ntuples;
+    for (int t = 0; t < layout->ntuples; t++) {
+        h.ncells[t] = layout->ncells;
+        memcpy(h.cells[t], layout->cells[t], layout->ncells);
+    }
+
+    ntuple_network *net = new ntuple_network();
+    net->init(h, layout_name);
+    net->owned_weights = (float *)calloc(net->total_weights, sizeof(float));
+    if (!net->owned_weights) {
+        fprintf(stderr, "Unable to allocate %lu n-tuple weights\n", (unsigned long)net->total_weights);
+        abort();
+    }
+    net->weights = net->owned_weights;
+    net->expand();
+    return net;
+}
+
+ntuple_network *ntuple_network::load(const char *path) {
+    ntuple_network *net = new ntuple_network();
+    if (!net->file.open(path)) {
+        delete net;
+        return NULL;
+    }
+    if (net->file.size < NTUPLE_WEIGHTS_OFFSET) {
+        fprintf(stderr, "%s: not an n-tuple network\n", path);
+        delete net;
+        return NULL;
+    }
+    if (!net->init(*(const ntuple_file_header *)net->file.data, path)) {
+        delete net;
+        return NULL;
+    }
+    if (net->file.size != NTUPLE_WEIGHTS_OFFSET + net->total_weights * sizeof(float)) {
+        fprintf(stderr, "%s: truncated n-tuple network\n", path);
+        delete net;
+        return NULL;
+    }
+    net->weights = (const float *)((const char *)net->file.data + NTUPLE_WEIGHTS_OFFSET);
+    if (!net->check_max_weights(path)) {
+        delete net;
+        return NULL;
+    }
+    net->expand();
+    return net;
+}
+
+/* max_value() trusts the header's largest weights, and the search prunes with them, so a
+ * header that understates them would cut off moves that are not actually worse. */
+bool ntuple_network::check_max_weights(const char *path) const {
+    const float *w = weights;
+    for (unsigned t = 0; t < header.ntuples; t++) {
+        size_t n = tuple_weights(header.ncells[t]);
+        float actual = max_weight(w, n);
+        if (!(actual <= header.max_weight[t])) {
+            fprintf(stderr, "%s: tuple %u has weight %g above its recorded maximum %g\n",
+                path, t, actual, header.max_weight[t]);
+            return false;
+        }
+        w += n;
+    }
+    return true;
+}
+
+ntuple_network *ntuple_network::load_writable(const char *path) {
+    ntuple_network *mapped = load(path);
+    if (!mapped)
+        return NULL;
+
+    ntuple_network *net = new ntuple_network();
+    net->init(mapped->header, path);
+    net->owned_weights = (float *)malloc(net->total_weights * sizeof(float));
+    if (!net->owned_weights) {
+        fprintf(stderr, "Unable to allocate %lu n-tuple weights\n", (unsigned long)net->total_weights);
+        abort();
+    }
+    memcpy(net->owned_weights, mapped->weights, net->total_weights * sizeof(float));
+    net->weights = net->owned_weights;
+    net->expand();
+    delete mapped;
+    return net;
+}
+
+bool ntuple_network::save(const char *path) const {
+    ntuple_file_header h = header;
+    const float *w = weights;
+    for (unsigned t = 0; t < h.ntuples; t++) {
+        size_t n = tuple_weights(h.ncells[t]);
+        h.max_weight[t] = max_weight(w, n);
+        w += n;
+    }
+
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        perror(path);
+        return false;
+    }
+    char pad[NTUPLE_WEIGHTS_OFFSET - sizeof(h)];
+    memset(pad, 0, sizeof(pad));
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+        fwrite(pad, sizeof(pad), 1, f) == 1 &&
+        fwrite(weights, sizeof(float), total_weights, f) == total_weights;
+    ok = (fclose(f) == 0) && ok;
+    if (!ok)
+        fprintf(stderr, "%s: write failed\n", path);
+    return ok;
+}
+
+/* Every tuple under every symmetry, with its cells turned into shifts, so that value()
+ * reads the original board instead of transforming it eight times. */
+void ntuple_network::expand() {
+    nexpanded = 0;
+    const float *w = weights;
+    for (unsigned t = 0; t < header.ntuples; t++) {
+        for (int sym = 0; sym < 8; sym++) {
+            expanded_tuple &e = expanded[nexpanded++];
+            e.weights = w;
+            e.ncells = header.ncells[t];
+            for (int i = 0; i < e.ncells; i++)
+                e.shifts[i] = 4 * map_cell(header.cells[t][i], sym);
+        }
+        w += tuple_weights(header.ncells[t]);
+    }
+}
+
+float ntuple_network::value(board_t board) const {
+    float sum = 0.0f;
+    for (int i = 0; i < nexpanded; i++)
+        sum += expanded[i].weights[tuple_index(expanded[i], board)];
+    return sum;
+}
+
+void ntuple_network::update(board_t board, float delta) {
+    float step = delta / nexpanded;
+    for (int i = 0; i < nexpanded; i++) {
+        float *w = owned_weights + (expanded[i].weights - weights);
+        w[tuple_index(expanded[i], board)] += step;
+    }
+}
+
+float ntuple_network::max_value() const {
+    float bound = 0.0f;
+    const float *w = weights;
+    for (unsigned t = 0; t < header.ntuples; t++) {
+        size_t n = tuple_weights(header.ncells[t]);
+        float largest = owned_weights ? max_weight(w, n) : header.max_weight[t];
+        bound += 8 * std::max(0.0f, largest);
+        w += n;
+    }
+    return bound;
+}
@@ -0,0 +1,103 @@
+#ifndef NTUPLE_H
+#define NTUPLE_H
+
+#include <stdint.h>
+
+#include "2048.h"
+#include "mapped_file.h"
+
+/* N-tuple network.
+ *
+ * A tuple is a fixed group of cells, with a weight for every combination of ranks those
+ * cells can hold. A board's value is the sum of the weights its tiles select in each
+ * tuple, over all 8 rotations and reflections of the board, so symmetric positions share
+ * their weights. Trained by TD learning on afterstates (see train_ntuple.cpp), value()
+ * estimates the score still to be made from a board just after a move.
+ *
+ * File format (native byte order): an ntuple_file_header, then, from byte
+ * NTUPLE_WEIGHTS_OFFSET, the weights of each tuple in turn: 16^ncells floats, indexed by
+ * the ranks in its cells, the first cell in the lowest 4 bits. The header records each
+ * tuple's largest weight, which gives a loaded network its upper bound; load() checks
+ * them against the weights once, and rejects a file whose header understates them.
+ */
+
+static const int NTUPLE_MAX_TUPLES = 16;
+static const int NTUPLE_MAX_CELLS = 6; // 16^6 weights = 64 MB per tuple
+static const int NTUPLE_VERSION = 1;
+static const size_t NTUPLE_WEIGHTS_OFFSET = 256;
+
+struct ntuple_file_header {
+    char magic[8]; // "2048NTUP"
+    uint32_t version;
+    uint32_t ntuples;
+    uint8_t ncells[NTUPLE_MAX_TUPLES];
+    uint8_t cells[NTUPLE_MAX_TUPLES][NTUPLE_MAX_CELLS]; // cell 4 * row + col, as in board_t
+    float max_weight[NTUPLE_MAX_TUPLES];
+};
+
+class ntuple_network {
+public:
+    /* A network of zeros, for training, with one of the built-in tuple layouts:
+     *   "4": the outer and second rows and three 2x2 squares (1.25 MB)
+     *   "6": the four 6-cell tuples of Jaskowski's networks (256 MB)
+     * Returns NULL for any other name. */
+    static ntuple_network *create(const char *layout);
+
+    /* Map a network file read-only. Returns NULL, with the reason on stderr, if the file is
+     * not a valid network. */
+    static ntuple_network *load(const char *path);
+
+    /* Read a network file into writable memory, to train it further. */
+    static ntuple_network *load_writable(const char *path);
+
+    ~ntuple_network();
+
+    /* Write the network (and the largest weight of each tuple) to `path`. */
+    bool save(const char *path) const;
+
+    float value(board_t board) const;
+
+    /* Move value(board) by `delta`, spread evenly over the weights that make it up. Only
+     * for writable networks. */
+    void update(board_t board, float delta);
+
+    /* Upper bound on value() over all boards. For a loaded network it comes from the
+     * header, as checked by load(); a writable one has to scan its weights. */
+    float max_value() const;
+
+    size_t num_weights() const {
+        return total_weights;
+    }
+
+private:
+    struct expanded_tuple {
+        const float *weights;
+        int ncells;
+        uint8_t shifts[NTUPLE_MAX_CELLS]; // bit position of each cell in the board
+    };
+
+    ntuple_network();
+    bool init(const ntuple_file_header &header, const char *path);
+    bool check_max_weights(const char *path) const;
+    void expand();
+
+    static inline unsigned tuple_index(const expanded_tuple &t, board_t board) {
+        unsigned index = 0;
+        for (int i = 0; i < t.ncells; i++)
+            index |= ((board >> t.shifts[i]) & 0xf) << (4 * i);
+        return index;
+    }
+
+    ntuple_file_header header;
+    const float *weights;
+    float *owned_weights; // the same weights, when they are writable rather than mapped
+    size_t total_weights;
+    mapped_file file;
+    int nexpanded;
+    expanded_tuple expanded[NTUPLE_MAX_TUPLES * 8]; // every tuple under every symmetry
+
+    ntuple_network(const ntuple_network &);
+    ntuple_network &operator=(const ntuple_network &);
+};
+
+#endif /* NTUPLE_H */
@@ -0,0 +1,197 @@
+/* Replay analyzer.
+ *
+ * Every position of a record file is searched again with score_toplevel_move, and the
+ * recorded move is compared with the best one: its loss is the share of the best move's
+ * score it gives up, and a move losing more than a threshold is a blunder. Run over games
+ * played by another engine version, or with other settings, the agreement rate and the
+ * blunders show where the two differ.
+ *
+ * The file is memory-mapped, and whole games are handed out to threads, each with its own
+ * single-threaded search context that is reset at the start of a game and kept over its
+ * plies, as when the game was played.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "game_record.h"
+#include "replay.h"
+
+struct replay_blunder {
+    uint32_t game;
+    int ply; // move number within the game, from 0
+    board_t board;
+    int move;
+    int best_move;
+    float loss;
+    float scores[4];
+};
+
+static bool blunder_less(const replay_blunder &a, const replay_blunder &b) {
+    return a.game < b.game || (a.game == b.game && a.ply < b.ply);
+}
+
+struct replay_shared {
+    const game_record_file *records;
+    std::vector<uint64_t> game_starts; // index of each game's first ply, then records->count
+    int max_depth;
+    unsigned trans_table_mb;
+    const char *ntuple_fn;
+    float blunder_loss;
+    std::atomic<size_t> next_game;
+
+    std::mutex lock; // guards everything below
+    uint64_t plies;
+    uint64_t agreed;
+    double total_loss;
+    std::vector<replay_blunder> blunders;
+};
+
+static void replay_worker(replay_shared *shared) {
+    search_context_t *ctx = create_search_context(shared->trans_table_mb);
+    set_search_option(ctx, SEARCH_OPT_THREADS, 1);
+    set_search_option(ctx, SEARCH_OPT_MAX_DEPTH, shared->max_depth);
+    if (shared->ntuple_fn)
+        set_ntuple_network(ctx, shared->ntuple_fn);
+
+    while (true) {
+        size_t game = shared->next_game++;
+        if (game + 1 >= shared->game_starts.size())
+            break;
+
+        uint64_t agreed = 0;
+        double total_loss = 0;
+        std::vector<replay_blunder> blunders;
+        uint64_t begin = shared->game_starts[game], end = shared->game_starts[game + 1];
+        reset_search_context(ctx);
+        for (uint64_t i = begin; i < end; i++) {
+            const game_record_ply &ply = shared->records->plies[i];
+            float scores[4];
+            int best_move = 0;
+            for (int move = 0; move < 4; move++) {
+                scores[move] = score_toplevel_move_ctx(ctx, ply.board, move);
+                if (scores[move] > scores[best_move])
+                    best_move = move;
+            }
+            float best = scores[best_move];
+            float loss = (best > 0) ? (best - scores[ply.move & 3]) / best : 0.0f;
+            agreed += (best_move == ply.move);
+            total_loss += loss;
+            if (loss > shared->blunder_loss) {
+                replay_blunder blunder;
+                blunder.game = ply.game;
+                blunder.ply = (int)(i - begin);
+                blunder.board = ply.board;
+                blunder.move = ply.move;
+                blunder.best_move = best_move;
+                blunder.loss = loss;
+                memcpy(blunder.scores, scores, sizeof(scores));
+                blunders.push_back(blunder);
+            }
+        }
+
+        std::lock_guard<std::mutex> guard(shared->lock);
+        shared->plies += end - begin;
+        shared->agreed += agreed;
+        shared->total_loss += total_loss;
+        shared->blunders.insert(shared->blunders.end(), blunders.begin(), blunders.end());
+    }
+
+    free_search_context(ctx);
+}
+
+static void replay_usage(const char *argv0) {
+    fprintf(stderr,
+        "Usage: %s replay -i record_file [-j threads] [-d max_depth] [-m trans_table_mb] [-b blunder_loss] [-e ntuple_file]\n"
+        "  -i record_file    game record file to analyze (see selfplay -r)\n"
+        "  -j threads        games analyzed concurrently, 0 = one per core (default 0)\n"
+        "  -d max_depth      cap on the search depth, 0 = none (default 0)\n"
+        "  -m trans_table_mb transposition table size per thread (default 16)\n"
+        "  -b blunder_loss   report moves giving up more than this share of the best move's score (default 0.02)\n"
+        "  -e ntuple_file    score leaves with this n-tuple network instead of the heuristic\n",
+        argv0);
+    exit(1);
+}
+
+int replay_main(int argc, char **argv) {
+    const char *record_fn = NULL;
+    int threads = 0;
+    replay_shared shared;
+    shared.max_depth = 0;
+    shared.trans_table_mb = 16;
+    shared.ntuple_fn = NULL;
+    shared.blunder_loss = 0.02f;
+
+    for (int i = 2; i < argc; i++) {
+        if (i + 1 >= argc || argv[i][0] != '-' || strlen(argv[i]) != 2)
+            replay_usage(argv[0]);
+        const char *arg = argv[++i];
+        switch (argv[i - 1][1]) {
+        case 'i': record_fn = arg; break;
+        case 'j': threads = atoi(arg); break;
+        case 'd': shared.max_depth = atoi(arg); break;
+        case 'm': shared.trans_table_mb = atoi(arg); break;
+        case 'b': shared.blunder_loss = atof(arg); break;
+        case 'e': shared.ntuple_fn = arg; break;
+        default: replay_usage(argv[0]);
+        }
+    }
+    if (!record_fn)
+        replay_usage(argv[0]);
+
+    game_record_file *records = game_record_file::load(record_fn);
+    if (!records)
+        return 1;
+    if (shared.ntuple_fn) {
+        search_context_t *probe = create_search_context(4);
+        int status = set_ntuple_network(probe, shared.ntuple_fn);
+        free_search_context(probe);
+        if (status < 0)
+            return 1;
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    shared.records = records;
+    for (uint64_t i = 0; i < records->count; i++) {
+        if (i == 0 || (records->plies[i].flags & GAME_RECORD_FIRST_PLY) || records->plies[i].game != records->plies[i - 1].game)
+            shared.game_starts.push_back(i);
+    }
+    shared.game_starts.push_back(records->count);
+    shared.next_game = 0;
+    shared.plies = 0;
+    shared.agreed = 0;
+    shared.total_loss = 0;
+
+    if (threads <= 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; i++)
+        workers.push_back(std::thread(replay_worker, &shared));
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::sort(shared.blunders.begin(), shared.blunders.end(), blunder_less);
+    for (size_t i = 0; i < shared.blunders.size(); i++) {
+        const replay_blunder &b = shared.blunders[i];
+        printf("{\"game\": %u, \"ply\": %d, \"board\": \"0x%016llx\", \"move\": %d, \"best_move\": %d, \"loss\": %.4f, \"scores\": [%.1f, %.1f, %.1f, %.1f]}\n",
+            b.game, b.ply, (unsigned long long)b.board, b.move, b.best_move, b.loss, b.scores[0], b.scores[1], b.scores[2], b.scores[3]);
+    }
+    size_t games = shared.game_starts.size() - 1;
+    printf("{\"summary\": true, \"games\": %lu, \"plies\": %llu, \"agreement\": %.4f, \"mean_loss\": %.5f, \"blunders\": %lu, "
+        "\"elapsed_sec\": %.3f, \"plies_per_sec\": %.1f}\n",
+        (unsigned long)games, (unsigned long long)shared.plies, shared.plies ? (double)shared.agreed / shared.plies : 0.0,
+        shared.plies ? shared.total_loss / shared.plies : 0.0, (unsigned long)shared.blunders.size(),
+        elapsed.count(), shared.plies / elapsed.count());
+
+    delete records;
+    return 0;
+}
@@ -0,0 +1,8 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+/* `bin/2048 replay ...`: re-search every position of a game record file (see
+ * game_record.h), and report the moves the engine disagrees with. */
+int replay_main(int argc, char **argv);
+
+#endif /* REPLAY_H */
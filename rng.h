@@ -0,0 +1,47 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+
+/* Seedable random number generator for playing games: xoshiro256** (Blackman & Vigna),
+ * with the state expanded from a 64-bit seed by splitmix64. A game owns its generator,
+ * so a game is reproducible from its seed no matter what else runs in the process. */
+typedef struct {
+    uint64_t s[4];
+} rng_t;
+
+static inline uint64_t splitmix64(uint64_t *x) {
+    uint64_t z = (*x += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static inline void rng_seed(rng_t *rng, uint64_t seed) {
+    for (int i = 0; i < 4; ++i)
+        rng->s[i] = splitmix64(&seed);
+}
+
+static inline uint64_t rng_rotl(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+static inline uint64_t rng_next(rng_t *rng) {
+    uint64_t *s = rng->s;
+    uint64_t result = rng_rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rng_rotl(s[3], 45);
+    return result;
+}
+
+/* A value in [0..n-1], by Lemire's multiply-shift; the bias is below 2^-32 for the small n we use. */
+static inline unsigned rng_uniform(rng_t *rng, unsigned n) {
+    return (unsigned)(((rng_next(rng) >> 32) * n) >> 32);
+}
+
+#endif /* RNG_H */
@@ -0,0 +1,392 @@
+#include <math.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "selfplay.h"
+
+struct selfplay_shared {
+    const selfplay_config *config;
+    std::atomic<int> next_game;
+    std::mutex done_lock;
+    selfplay_done_func_t done;
+    void *user;
+};
+
+struct selfplay_player {
+    const selfplay_config *config;
+    search_context_t *ctx;
+    game_recorder recorder;
+};
+
+static int selfplay_get_move(board_t board, void *user) {
+    selfplay_player *player = (selfplay_player *)user;
+    if (player->config->observe)
+        player->config->observe(board, player->config->observe_user);
+    int move = find_best_move_ctx(player->ctx, board);
+    if (player->config->record)
+        player->recorder.move(board, move);
+    return move;
+}
+
+static void selfplay_worker(selfplay_shared *shared) {
+    const selfplay_config &config = *shared->config;
+    search_context_t *ctx = create_search_context(config.trans_table_mb);
+    set_search_option(ctx, SEARCH_OPT_VERBOSE, 0);
+    set_search_option(ctx, SEARCH_OPT_THREADS, 1);
+    set_search_option(ctx, SEARCH_OPT_MAX_DEPTH, config.max_depth);
+    set_search_option(ctx, SEARCH_OPT_ENGINE, config.engine);
+    if (config.mcts_playouts)
+        set_search_option(ctx, SEARCH_OPT_MCTS_PLAYOUTS, config.mcts_playouts);
+    int total = config.games * std::max(1, config.nweights);
+    int vector = -1; // weights the context is set up for
+    selfplay_player player;
+    player.config = &config;
+    player.ctx = ctx;
+
+    while (true) {
+        int index = config.next ? config.next(config.next_user) : shared->next_game++;
+        if (index < 0 || index >= total)
+            break;
+
+        selfplay_game game;
+        game.index = index % config.games;
+        game.vector = index / config.games;
+        game.seed = config.first_seed + game.index;
+        if (config.weights && game.vector != vector) {
+            vector = game.vector;
+            set_heur_weights(ctx, &config.weights[vector]);
+        }
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        reset_search_context(ctx);
+        player.recorder.begin(index);
+        play_game_seeded(game.seed, selfplay_get_move, &player, 0, &game.result);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        game.elapsed = elapsed.count();
+        game.plies = NULL;
+        if (config.record) {
+            player.recorder.end(game.result.board);
+            game.plies = &player.recorder.plies();
+        }
+
+        if (shared->done) {
+            std::lock_guard<std::mutex> guard(shared->done_lock);
+            shared->done(game, shared->user);
+        }
+    }
+
+    free_search_context(ctx);
+}
+
+void run_selfplay(const selfplay_config &config, selfplay_done_func_t done, void *user) {
+    selfplay_shared shared;
+    shared.config = &config;
+    shared.next_game = 0;
+    shared.done = done;
+    shared.user = user;
+
+    int threads = config.threads > 0 ? config.threads : std::max(1u, std::thread::hardware_concurrency());
+    threads = std::min(threads, config.games * std::max(1, config.nweights));
+
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; i++)
+        workers.push_back(std::thread(selfplay_worker, &shared));
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+}
+
+/* Command-line driver */
+
+void print_selfplay_game(const selfplay_game &game, void *user) {
+    selfplay_summary *summary = (selfplay_summary *)user;
+    summary->games++;
+    summary->total_score += game.result.score;
+    summary->total_moves += game.result.moves;
+    summary->maxrank_counts[game.result.maxrank]++;
+    if (summary->records && summary->records_ok)
+        summary->records_ok = summary->records->write(*game.plies);
+
+    printf("{\"game\": %d, \"seed\": %llu, \"score\": %u, \"max_tile\": %d, \"moves\": %d, \"elapsed_sec\": %.3f}\n",
+        game.index, (unsigned long long)game.seed, game.result.score, 1 << game.result.maxrank, game.result.moves, game.elapsed);
+    fflush(stdout);
+}
+
+void print_selfplay_summary(const selfplay_summary &summary, double elapsed) {
+    printf("{\"summary\": true, \"games\": %d, \"mean_score\": %.1f, \"moves\": %llu, \"elapsed_sec\": %.3f, \"games_per_sec\": %.3f, \"max_tile\": {",
+        summary.games, summary.total_score / summary.games, (unsigned long long)summary.total_moves,
+        elapsed, summary.games / elapsed);
+    const char *sep = "";
+    for (int rank = 0; rank < 16; rank++) {
+        if (summary.maxrank_counts[rank]) {
+            printf("%s\"%d\": %d", sep, 1 << rank, summary.maxrank_counts[rank]);
+            sep = ", ";
+        }
+    }
+    printf("}}\n");
+}
+
+static void selfplay_usage(const char *argv0) {
+    fprintf(stderr,
+        "Usage: %s selfplay [-n games] [-s first_seed] [-j threads] [-d max_depth] [-m trans_table_mb] [-E engine] [-P playouts] [-r record_file]\n"
+        "  -n games          number of games to play (default 100)\n"
+        "  -s first_seed     seed of the first game; game i uses first_seed + i (default 1)\n"
+        "  -j threads        games played concurrently, 0 = one per core (default 0)\n"
+        "  -d max_depth      cap on the search depth, 0 = none (default 0)\n"
+        "  -m trans_table_mb transposition table size per thread (default 16)\n"
+        "  -E engine         0 = expectimax, 1 = Monte Carlo tree search (default 0)\n"
+        "  -P playouts       MCTS playouts per move (default 10000)\n"
+        "  -r record_file    write every move of every game to this file (see game_record.h)\n",
+        argv0);
+    exit(1);
+}
+
+int selfplay_main(int argc, char **argv) {
+    selfplay_config config;
+    config.games = 100;
+    config.trans_table_mb = 16;
+    const char *record_fn = NULL;
+
+    for (int i = 2; i < argc; i++) {
+        if (i + 1 >= argc || argv[i][0] != '-' || strlen(argv[i]) != 2)
+            selfplay_usage(argv[0]);
+        const char *arg = argv[++i];
+        switch (argv[i - 1][1]) {
+        case 'n': config.games = atoi(arg); break;
+        case 's': config.first_seed = strtoull(arg, NULL, 0); break;
+        case 'j': config.threads = atoi(arg); break;
+        case 'd': config.max_depth = atoi(arg); break;
+        case 'm': config.trans_table_mb = atoi(arg); break;
+        case 'E': config.engine = atoi(arg); break;
+        case 'P': config.mcts_playouts = atoi(arg); break;
+        case 'r': record_fn = arg; break;
+        default: selfplay_usage(argv[0]);
+        }
+    }
+    if (config.games <= 0)
+        selfplay_usage(argv[0]);
+
+    selfplay_summary summary;
+    memset(&summary, 0, sizeof(summary));
+    game_record_writer records;
+    if (record_fn) {
+        if (!records.open(record_fn))
+            return 1;
+        config.record = true;
+        summary.records = &records;
+        summary.records_ok = true;
+    }
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    run_selfplay(config, print_selfplay_game, &summary);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    print_selfplay_summary(summary, elapsed.count());
+    if (record_fn && !(records.close() && summary.records_ok))
+        return 1;
+    return 0;
+}
+
+/* Parameter sweep */
+
+static const struct {
+    const char *name;
+    size_t offset;
+} heur_weight_fields[] = {
+    {"lost_penalty", offsetof(heur_weights_t, lost_penalty)},
+    {"monotonicity_power", offsetof(heur_weights_t, monotonicity_power)},
+    {"monotonicity_weight", offsetof(heur_weights_t, monotonicity_weight)},
+    {"sum_power", offsetof(heur_weights_t, sum_power)},
+    {"sum_weight", offsetof(heur_weights_t, sum_weight)},
+    {"merges_weight", offsetof(heur_weights_t, merges_weight)},
+    {"empty_weight", offsetof(heur_weights_t, empty_weight)},
+};
+static const int NUM_HEUR_WEIGHT_FIELDS = sizeof(heur_weight_fields) / sizeof(heur_weight_fields[0]);
+
+static float &heur_weight_field(heur_weights_t &weights, int field) {
+    return *(float *)((char *)&weights + heur_weight_fields[field].offset);
+}
+
+/* One vector per line, as name=value pairs separated by spaces; weights a line leaves out
+ * keep their built-in values, and a line reading "default" is the baseline. '#' starts a
+ * comment, and blank lines are skipped. */
+static bool read_weight_vectors(FILE *f, std::vector<heur_weights_t> &vectors) {
+    char line[1024];
+    int lineno = 0;
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        char *comment = strchr(line, '#');
+        if (comment)
+            *comment = '\0';
+
+        heur_weights_t weights;
+        get_default_heur_weights(&weights);
+        bool blank = true;
+        for (char *tok = strtok(line, " \t\r\n"); tok; tok = strtok(NULL, " \t\r\n")) {
+            blank = false;
+            if (!strcmp(tok, "default"))
+                continue;
+            char *eq = strchr(tok, '=');
+            int field = 0;
+            if (eq) {
+                *eq = '\0';
+                while (field < NUM_HEUR_WEIGHT_FIELDS && strcmp(tok, heur_weight_fields[field].name))
+                    field++;
+            }
+            char *end = NULL;
+            float value = eq ? strtof(eq + 1, &end) : 0.0f;
+            if (!eq || field == NUM_HEUR_WEIGHT_FIELDS || end == eq + 1 || *end) {
+                fprintf(stderr, "line %d: expected name=value, with name one of:", lineno);
+                for (int i = 0; i < NUM_HEUR_WEIGHT_FIELDS; i++)
+                    fprintf(stderr, " %s", heur_weight_fields[i].name);
+                fprintf(stderr, "\n");
+                return false;
+            }
+            heur_weight_field(weights, field) = value;
+        }
+        if (!blank)
+            vectors.push_back(weights);
+    }
+    return true;
+}
+
+struct sweep_results {
+    const selfplay_config *config;
+    std::vector<std::vector<selfplay_game> > games; // per vector
+    int best_vector;
+    double best_mean;
+};
+
+static bool score_less(const selfplay_game &a, const selfplay_game &b) {
+    return a.result.score < b.result.score;
+}
+
+static void print_sweep_vector(const selfplay_config &config, int vector, std::vector<selfplay_game> &games, double &mean) {
+    double total_score = 0, total_moves = 0;
+    int maxrank_counts[16] = {0};
+    for (size_t i = 0; i < games.size(); i++) {
+        total_score += games[i].result.score;
+        total_moves += games[i].result.moves;
+        maxrank_counts[games[i].result.maxrank]++;
+    }
+    mean = total_score / games.size();
+    double var = 0;
+    for (size_t i = 0; i < games.size(); i++)
+        var += (games[i].result.score - mean) * (games[i].result.score - mean);
+    double stddev = games.size() > 1 ? sqrt(var / (games.size() - 1)) : 0.0;
+    std::sort(games.begin(), games.end(), score_less);
+
+    printf("{\"vector\": %d, \"weights\": {", vector);
+    heur_weights_t weights = config.weights[vector];
+    for (int i = 0; i < NUM_HEUR_WEIGHT_FIELDS; i++)
+        printf("%s\"%s\": %g", i ? ", " : "", heur_weight_fields[i].name, heur_weight_field(weights, i));
+    printf("}, \"games\": %d, \"mean_score\": %.1f, \"stddev_score\": %.1f, \"stderr_score\": %.1f, "
+        "\"min_score\": %u, \"median_score\": %u, \"max_score\": %u, \"mean_moves\": %.1f, \"max_tile\": {",
+        (int)games.size(), mean, stddev, stddev / sqrt((double)games.size()),
+        games.front().result.score, games[games.size() / 2].result.score, games.back().result.score,
+        total_moves / games.size());
+    const char *sep = "";
+    for (int rank = 0; rank < 16; rank++) {
+        if (maxrank_counts[rank]) {
+            printf("%s\"%d\": %d", sep, 1 << rank, maxrank_counts[rank]);
+            sep = ", ";
+        }
+    }
+    printf("}}\n");
+    fflush(stdout);
+}
+
+// a vector's line is printed as soon as its last game finishes
+static void record_sweep_game(const selfplay_game &game, void *user) {
+    sweep_results *results = (sweep_results *)user;
+    std::vector<selfplay_game> &games = results->games[game.vector];
+    games.push_back(game);
+    if ((int)games.size() < results->config->games)
+        return;
+
+    double mean;
+    print_sweep_vector(*results->config, game.vector, games, mean);
+    if (results->best_vector < 0 || mean > results->best_mean) {
+        results->best_vector = game.vector;
+        results->best_mean = mean;
+    }
+}
+
+static void sweep_usage(const char *argv0) {
+    fprintf(stderr,
+        "Usage: %s sweep [-f vectors] [-n games] [-s first_seed] [-j threads] [-d max_depth] [-m trans_table_mb]\n"
+        "  -f vectors        file of weight vectors, one per line as name=value pairs;\n"
+        "                    unlisted weights keep their built-in values (default: stdin)\n"
+        "  -n games          games per vector; every vector plays the same seeds (default 20)\n"
+        "  -s first_seed     seed of the first game; game i uses first_seed + i (default 1)\n"
+        "  -j threads        games played concurrently, 0 = one per core (default 0)\n"
+        "  -d max_depth      cap on the search depth, 0 = none (default 2)\n"
+        "  -m trans_table_mb transposition table size per thread (default 16)\n",
+        argv0);
+    exit(1);
+}
+
+int sweep_main(int argc, char **argv) {
+    selfplay_config config;
+    config.games = 20;
+    config.max_depth = 2;
+    config.trans_table_mb = 16;
+    const char *vectors_fn = NULL;
+
+    for (int i = 2; i < argc; i++) {
+        if (i + 1 >= argc || argv[i][0] != '-' || strlen(argv[i]) != 2)
+            sweep_usage(argv[0]);
+        const char *arg = argv[++i];
+        switch (argv[i - 1][1]) {
+        case 'f': vectors_fn = arg; break;
+        case 'n': config.games = atoi(arg); break;
+        case 's': config.first_seed = strtoull(arg, NULL, 0); break;
+        case 'j': config.threads = atoi(arg); break;
+        case 'd': config.max_depth = atoi(arg); break;
+        case 'm': config.trans_table_mb = atoi(arg); break;
+        default: sweep_usage(argv[0]);
+        }
+    }
+    if (config.games <= 0)
+        sweep_usage(argv[0]);
+
+    FILE *f = vectors_fn ? fopen(vectors_fn, "r") : stdin;
+    if (!f) {
+        perror(vectors_fn);
+        return 1;
+    }
+    std::vector<heur_weights_t> vectors;
+    bool ok = read_weight_vectors(f, vectors);
+    if (f != stdin)
+        fclose(f);
+    if (!ok)
+        return 1;
+    if (vectors.empty()) {
+        fprintf(stderr, "no weight vectors given\n");
+        return 1;
+    }
+    config.weights = &vectors[0];
+    config.nweights = vectors.size();
+
+    sweep_results results;
+    results.config = &config;
+    results.games.resize(vectors.size());
+    results.best_vector = -1;
+    results.best_mean = 0;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    run_selfplay(config, record_sweep_game, &results);
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    int total = config.games * config.nweights;
+    printf("{\"summary\": true, \"vectors\": %d, \"games\": %d, \"best_vector\": %d, \"best_mean_score\": %.1f, \"elapsed_sec\": %.3f, \"games_per_sec\": %.3f}\n",
+        config.nweights, total, results.best_vector, results.best_mean, elapsed.count(), total / elapsed.count());
+    return 0;
+}
@@ -0,0 +1,83 @@
+#ifndef SELFPLAY_H
+#define SELFPLAY_H
+
+#include "2048.h"
+#include "game_record.h"
+
+/* Self-play farm: plays many seeded games concurrently, one game per thread at a time.
+ *
+ * Game i is played from seed first_seed + i, with its own tile generator and its own
+ * single-threaded search context, so results do not depend on the number of threads or
+ * on how games are scheduled. Threads pull the next game index as they finish, and every
+ * finished game is reported through the callback (serialized by the farm) right away.
+ *
+ * Given several heuristic weight vectors, the farm plays the same games (the same seeds)
+ * with each of them, all from the one queue: vector v plays games v * games ... (v + 1) *
+ * games - 1, so the threads stay busy until the last game of the last vector.
+ *
+ * With a `next` callback, the caller hands out the game indices instead (see farm.h): the
+ * threads play whichever games it returns, in any order and possibly not all of them. */
+
+typedef void (*selfplay_move_func_t)(board_t board, void *user);
+// returns the index of the next game to play, or -1 once there are none; may block
+typedef int (*selfplay_next_func_t)(void *user);
+
+struct selfplay_config {
+    int games;
+    uint64_t first_seed;
+    int threads; // 0 = one per core
+    int max_depth; // search depth cap, 0 = none
+    unsigned trans_table_mb; // per thread; 0 = default
+    int engine; // SEARCH_ENGINE_*
+    unsigned mcts_playouts; // per move, with SEARCH_ENGINE_MCTS; 0 = default
+    const heur_weights_t *weights; // heuristic weight vectors to play the games with; NULL = the built-in weights
+    int nweights;
+    selfplay_move_func_t observe; // if set, called by the playing thread with every position before its move
+    void *observe_user;
+    bool record; // keep the plies of every game for the callback
+    selfplay_next_func_t next; // if set, threads take game indices from it instead of in order, until it returns -1
+    void *next_user;
+
+    selfplay_config() : games(1), first_seed(1), threads(0), max_depth(0), trans_table_mb(0), engine(SEARCH_ENGINE_EXPECTIMAX), mcts_playouts(0),
+        weights(NULL), nweights(0), observe(NULL), observe_user(NULL), record(false), next(NULL), next_user(NULL) {
+    }
+};
+
+struct selfplay_game {
+    int index; // game number for its weight vector
+    int vector; // index into selfplay_config::weights, or 0 without weights
+    uint64_t seed;
+    game_result_t result;
+    double elapsed; // seconds
+    const std::vector<game_record_ply> *plies; // with selfplay_config::record, else NULL
+};
+
+// `done` may be NULL
+typedef void (*selfplay_done_func_t)(const selfplay_game &game, void *user);
+
+void run_selfplay(const selfplay_config &config, selfplay_done_func_t done, void *user);
+
+/* Running totals of the games printed by print_selfplay_game. */
+struct selfplay_summary {
+    int games;
+    double total_score;
+    uint64_t total_moves;
+    int maxrank_counts[16];
+    game_record_writer *records; // NULL unless recording
+    bool records_ok;
+};
+
+/* selfplay_done_func_t for a selfplay_summary: print the game as a JSON line, add it to the
+ * totals, and write its plies to the summary's record file. */
+void print_selfplay_game(const selfplay_game &game, void *summary);
+
+void print_selfplay_summary(const selfplay_summary &summary, double elapsed);
+
+/* `bin/2048 selfplay ...`: stream one JSON line per finished game, then a summary line. */
+int selfplay_main(int argc, char **argv);
+
+/* `bin/2048 sweep ...`: play the same games with each weight vector read from a file, and
+ * print one JSON line of score statistics per vector. */
+int sweep_main(int argc, char **argv);
+
+#endif /* SELFPLAY_H */
@@ -0,0 +1,396 @@
+/* Analysis server (see server.h).
+ *
+ * Every connection has a reader thread, which queues the requests it reads on their
+ * sessions. A session with requests waiting sits in the ready queue, at most once, so that
+ * a single worker takes its requests one at a time; when that worker is done, the session
+ * goes to the back of the queue if it has more, which keeps a busy game from starving the
+ * others. A connection's sessions are freed once it is closed and its last request is
+ * answered.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "server.h"
+
+#ifndef _WIN32
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+static_assert(sizeof(server_request) == 24, "server_request is part of the wire format");
+static_assert(sizeof(server_response) == 36, "server_response is part of the wire format");
+
+struct server_config {
+    const char *socket_path; // NULL = serve stdin/stdout
+    int workers; // 0 = one per core
+    unsigned trans_table_mb; // per session
+    int max_depth;
+    const char *ntuple_fn;
+    const char *move_cache_fn;
+
+    server_config() : socket_path(NULL), workers(0), trans_table_mb(16), max_depth(0), ntuple_fn(NULL), move_cache_fn(NULL) {
+    }
+};
+
+#ifndef _WIN32
+
+struct server_conn;
+
+struct server_session {
+    uint32_t id;
+    server_conn *conn;
+    search_context_t *ctx; // created by the first request searched
+    std::deque<server_request> pending;
+    bool scheduled; // in the ready queue, or being searched
+
+    server_session(uint32_t id, server_conn *conn) : id(id), conn(conn), ctx(NULL), scheduled(false) {
+    }
+};
+
+struct server_conn {
+    int in_fd;
+    int out_fd;
+    std::mutex write_lock;
+    bool write_failed; // the client is gone; drop its remaining requests
+    std::map<uint32_t, server_session *> sessions;
+    int jobs; // requests read but not answered yet
+
+    server_conn(int in_fd, int out_fd) : in_fd(in_fd), out_fd(out_fd), write_failed(false), jobs(0) {
+    }
+};
+
+struct server_state {
+    const server_config *config;
+    std::mutex lock; // guards the ready queue and every connection's sessions and jobs
+    std::condition_variable work_ready;
+    std::condition_variable job_done;
+    std::deque<server_session *> ready;
+    bool stopping;
+};
+
+static bool read_full(int fd, void *buf, size_t len) {
+    char *p = (char *)buf;
+    while (len) {
+        ssize_t n = read(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool write_full(int fd, const void *buf, size_t len) {
+    const char *p = (const char *)buf;
+    while (len) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        len -= n;
+    }
+    return true;
+}
+
+static search_context_t *create_session_context(const server_config &config) {
+    search_context_t *ctx = create_search_context(config.trans_table_mb);
+    set_search_option(ctx, SEARCH_OPT_THREADS, 1);
+    set_search_option(ctx, SEARCH_OPT_MAX_DEPTH, config.max_depth);
+    // both files were checked at startup, and are shared by every session
+    if (config.ntuple_fn)
+        set_ntuple_network(ctx, config.ntuple_fn);
+    if (config.move_cache_fn)
+        set_move_cache(ctx, config.move_cache_fn);
+    return ctx;
+}
+
+static void search_request(const server_config &config, server_session &session, const server_request &req, server_response &resp) {
+    memset(&resp, 0, sizeof(resp));
+    resp.id = req.id;
+    resp.move = -1;
+    if (!req.board)
+        return;
+
+    if (!session.ctx)
+        session.ctx = create_session_context(config);
+    search_stats_t stats;
+    if (req.budget_ms)
+        resp.move = find_best_move_timed(session.ctx, req.board, req.budget_ms, 0, &stats);
+    else
+        resp.move = find_best_move_stats(session.ctx, req.board, &stats);
+    memcpy(resp.scores, stats.move_scores, sizeof(resp.scores));
+    resp.depth = stats.completed_depth;
+    resp.elapsed_us = (uint32_t)(stats.wall_time * 1e6);
+    resp.score_bounds = stats.move_score_bounds;
+}
+
+static void server_worker(server_state *server) {
+    std::unique_lock<std::mutex> guard(server->lock);
+    while (true) {
+        while (server->ready.empty() && !server->stopping)
+            server->work_ready.wait(guard);
+        if (server->ready.empty())
+            break;
+        server_session *session = server->ready.front();
+        server->ready.pop_front();
+        server_request req = session->pending.front();
+        session->pending.pop_front();
+        server_conn *conn = session->conn;
+        bool skip = conn->write_failed;
+        guard.unlock();
+
+        if (!skip) {
+            server_response resp;
+            search_request(*server->config, *session, req, resp);
+            std::lock_guard<std::mutex> write_guard(conn->write_lock);
+            if (!conn->write_failed && !write_full(conn->out_fd, &resp, sizeof(resp))) {
+                conn->write_failed = true;
+                // wake the reader, if it is waiting for more requests
+                shutdown(conn->in_fd, SHUT_RDWR);
+            }
+        }
+        if ((req.flags & SERVER_END_SESSION) && session->ctx) {
+            free_search_context(session->ctx);
+            session->ctx = NULL;
+        }
+
+        guard.lock();
+        if (!session->pending.empty()) {
+            server->ready.push_back(session);
+            server->work_ready.notify_one();
+        } else {
+            session->scheduled = false;
+            if (req.flags & SERVER_END_SESSION) {
+                conn->sessions.erase(session->id);
+                delete session;
+            }
+        }
+        if (--conn->jobs == 0)
+            server->job_done.notify_all();
+    }
+}
+
+/* Read requests until the client hangs up, then wait for the answers to the ones already
+ * read and free the connection's sessions. */
+static void serve_connection(server_state *server, server_conn *conn) {
+    server_request req;
+    while (read_full(conn->in_fd, &req, sizeof(req))) {
+        std::lock_guard<std::mutex> guard(server->lock);
+        server_session *&session = conn->sessions[req.session];
+        if (!session)
+            session = new server_session(req.session, conn);
+        session->pending.push_back(req);
+        conn->jobs++;
+        if (!session->scheduled) {
+            session->scheduled = true;
+            server->ready.push_back(session);
+            server->work_ready.notify_one();
+        }
+    }
+
+    std::unique_lock<std::mutex> guard(server->lock);
+    while (conn->jobs)
+        server->job_done.wait(guard);
+    for (std::map<uint32_t, server_session *>::iterator it = conn->sessions.begin(); it != conn->sessions.end(); ++it) {
+        if (it->second->ctx)
+            free_search_context(it->second->ctx);
+        delete it->second;
+    }
+    conn->sessions.clear();
+}
+
+static void serve_socket_client(server_state *server, int fd) {
+    server_conn *conn = new server_conn(fd, fd);
+    serve_connection(server, conn);
+    close(fd);
+    delete conn;
+}
+
+/* Remove a socket left behind by a server that is gone. Anything else at the path, including
+ * the socket of a server that is still listening, is reported and kept. */
+static bool remove_stale_socket(const char *path, const struct sockaddr_un &addr) {
+    struct stat st;
+    if (lstat(path, &st) < 0) {
+        if (errno == ENOENT)
+            return true;
+        perror(path);
+        return false;
+    }
+    if (!S_ISSOCK(st.st_mode)) {
+        fprintf(stderr, "%s: exists and is not a socket\n", path);
+        return false;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return false;
+    }
+    int err = connect(fd, (const struct sockaddr *)&addr, sizeof(addr)) < 0 ? errno : 0;
+    close(fd);
+    if (err != ECONNREFUSED) {
+        fprintf(stderr, "%s: %s\n", path, err ? strerror(err) : "another server is listening on it");
+        return false;
+    }
+    if (unlink(path) < 0) {
+        perror(path);
+        return false;
+    }
+    return true;
+}
+
+static int listen_unix(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "%s: socket path too long\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    if (!remove_stale_socket(path, addr)) {
+        close(fd);
+        return -1;
+    }
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 64) < 0) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// SIGINT and SIGTERM end the accept loop, so that the socket file is removed
+static volatile sig_atomic_t stop_signal = 0;
+static int signal_listen_fd = -1;
+
+static void stop_listening(int sig) {
+    stop_signal = sig;
+    shutdown(signal_listen_fd, SHUT_RDWR);
+}
+
+#endif /* _WIN32 */
+
+static void server_usage(const char *argv0) {
+    fprintf(stderr,
+        "Usage: %s serve [-u socket_path] [-j workers] [-m trans_table_mb] [-d max_depth] [-e ntuple_file] [-k move_cache]\n"
+        "  -u socket_path    listen on this Unix domain socket; without it, serve one client on stdin/stdout\n"
+        "  -j workers        concurrent searches, 0 = one per core (default 0)\n"
+        "  -m trans_table_mb transposition table size per session (default 16)\n"
+        "  -d max_depth      cap on the search depth, 0 = none (default 0)\n"
+        "  -e ntuple_file    score leaves with this n-tuple network instead of the heuristic\n"
+        "  -k move_cache     answer the positions in this move cache without searching\n",
+        argv0);
+    exit(1);
+}
+
+int server_main(int argc, char **argv) {
+    server_config config;
+
+    for (int i = 2; i < argc; i++) {
+        if (i + 1 >= argc || argv[i][0] != '-' || strlen(argv[i]) != 2)
+            server_usage(argv[0]);
+        const char *arg = argv[++i];
+        switch (argv[i - 1][1]) {
+        case 'u': config.socket_path = arg; break;
+        case 'j': config.workers = atoi(arg); break;
+        case 'm': config.trans_table_mb = atoi(arg); break;
+        case 'd': config.max_depth = atoi(arg); break;
+        case 'e': config.ntuple_fn = arg; break;
+        case 'k': config.move_cache_fn = arg; break;
+        default: server_usage(argv[0]);
+        }
+    }
+
+#ifdef _WIN32
+    fprintf(stderr, "The server needs Unix domain sockets, which this build does not support\n");
+    return 1;
+#else
+    // check the shared files once, rather than on every session's first request
+    search_context_t *probe = create_search_context(4);
+    bool ok = (!config.ntuple_fn || set_ntuple_network(probe, config.ntuple_fn) == 0) &&
+        (!config.move_cache_fn || set_move_cache(probe, config.move_cache_fn) == 0);
+    free_search_context(probe);
+    if (!ok)
+        return 1;
+
+    // a client hanging up shows up as a failed write instead
+    signal(SIGPIPE, SIG_IGN);
+
+    server_state server;
+    server.config = &config;
+    server.stopping = false;
+    int nworkers = config.workers > 0 ? config.workers : std::max(1u, std::thread::hardware_concurrency());
+    std::vector<std::thread> workers;
+    for (int i = 0; i < nworkers; i++)
+        workers.push_back(std::thread(server_worker, &server));
+
+    int status = 0;
+    if (config.socket_path) {
+        int listen_fd = listen_unix(config.socket_path);
+        if (listen_fd < 0) {
+            status = 1;
+        } else {
+            struct stat socket_stat;
+            memset(&socket_stat, 0, sizeof(socket_stat));
+            lstat(config.socket_path, &socket_stat);
+            signal_listen_fd = listen_fd;
+            signal(SIGINT, stop_listening);
+            signal(SIGTERM, stop_listening);
+            fprintf(stderr, "Listening on %s with %d workers\n", config.socket_path, nworkers);
+            while (!stop_signal) {
+                int fd = accept(listen_fd, NULL, NULL);
+                if (fd < 0) {
+                    if (stop_signal)
+                        break;
+                    if (errno == EINTR || errno == ECONNABORTED)
+                        continue;
+                    perror("accept");
+                    status = 1;
+                    break;
+                }
+                std::thread(serve_socket_client, &server, fd).detach();
+            }
+            close(listen_fd);
+            // unless another server has taken the path over since
+            struct stat st;
+            if (lstat(config.socket_path, &st) == 0 && st.st_dev == socket_stat.st_dev && st.st_ino == socket_stat.st_ino)
+                unlink(config.socket_path);
+        }
+    } else {
+        server_conn conn(0, 1);
+        serve_connection(&server, &conn);
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(server.lock);
+        server.stopping = true;
+        server.work_ready.notify_all();
+    }
+    for (size_t i = 0; i < workers.size(); i++)
+        workers[i].join();
+    return status;
+#endif
+}
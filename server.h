@@ -0,0 +1,48 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdint.h>
+
+#include "2048.h"
+
+/* Analysis server: one long-running engine shared by many games.
+ *
+ * `bin/2048 serve` answers search requests from clients connected to a Unix domain socket
+ * (or, without -u, from a single client on stdin/stdout). Each game is a session, named by
+ * the client, with its own search context that is created on the session's first request
+ * and kept, with its warm transposition table, until the client ends the session or
+ * disconnects. Sessions are numbered per connection, so clients cannot collide.
+ *
+ * Requests and responses are fixed-size binary messages in native byte order. A client
+ * may pipeline as many requests as it likes without waiting for answers: requests of
+ * different sessions are searched concurrently by a pool of worker threads, each search
+ * on one thread, and may be answered in any order; requests of one session are searched
+ * one after another, in the order they were sent. Responses carry the id of their
+ * request.
+ */
+
+enum {
+    SERVER_END_SESSION = 1, // drop the session's search context after answering
+};
+
+struct server_request {
+    uint32_t id; // echoed in the response
+    uint32_t session;
+    board_t board; // 0 = no search, e.g. to end a session
+    uint32_t budget_ms; // time budget of an iterative-deepening search; 0 = a fixed-depth search
+    uint32_t flags; // SERVER_*
+};
+
+struct server_response {
+    uint32_t id;
+    int32_t move; // best move, or -1 if there is none
+    float scores[4]; // see search_stats_t::move_scores
+    int32_t depth; // depth of the search the move comes from
+    uint32_t elapsed_us; // time spent searching
+    uint32_t score_bounds; // mask of the scores that are only upper bounds; see search_stats_t::move_score_bounds
+};
+
+/* `bin/2048 serve ...` */
+int server_main(int argc, char **argv);
+
+#endif /* SERVER_H */
@@ -0,0 +1,138 @@
+#ifndef TABLES_H
+#define TABLES_H
+
+#include <math.h>
+#include <algorithm>
+
+#include "2048.h"
+
+/* Row tables are computed one row (or column, read as a row) at a time by the functions
+ * below. gentables.cpp runs them over all 65536 rows at build time and emits the tables
+ * as constant arrays into bin/tables.inc, which 2048.cpp includes; the tables then live in
+ * read-only pages that every process using the engine shares. */
+
+/* One entry of the compact layout (COMPACT_TABLES, see 2048.cpp): everything the search
+ * looks up for a row, in 8 bytes. */
+struct row_entry_t {
+    row_t left; // row ^ (row moved left)
+    row_t right; // row ^ (row moved right)
+    float heur; // heuristic score of the row
+};
+
+// Heuristic scoring settings; the tables built into the engine use these
+static const heur_weights_t DEFAULT_HEUR_WEIGHTS = {
+    200000.0f, // lost_penalty
+    4.0f, // monotonicity_power
+    47.0f, // monotonicity_weight
+    3.5f, // sum_power
+    11.0f, // sum_weight
+    700.0f, // merges_weight
+    270.0f, // empty_weight
+};
+
+static inline void unpack_row(unsigned row, unsigned line[4]) {
+    line[0] = (row >>  0) & 0xf;
+    line[1] = (row >>  4) & 0xf;
+    line[2] = (row >>  8) & 0xf;
+    line[3] = (row >> 12) & 0xf;
+}
+
+static inline float row_score(unsigned row) {
+    unsigned line[4];
+    unpack_row(row, line);
+
+    float score = 0.0f;
+    for (int i = 0; i < 4; ++i) {
+        int rank = line[i];
+        if (rank >= 2) {
+            // the score is the total sum of the tile and all intermediate merged tiles
+            score += (rank - 1) * (1 << rank);
+        }
+    }
+    return score;
+}
+
+static inline float row_heur_score(unsigned row, const heur_weights_t &weights) {
+    unsigned line[4];
+    unpack_row(row, line);
+
+    float sum = 0;
+    int empty = 0;
+    int merges = 0;
+
+    int prev = 0;
+    int counter = 0;
+    for (int i = 0; i < 4; ++i) {
+        int rank = line[i];
+        sum += pow(rank, weights.sum_power);
+        if (rank == 0) {
+            empty++;
+        } else {
+            if (prev == rank) {
+                counter++;
+            } else if (counter > 0) {
+                merges += 1 + counter;
+                counter = 0;
+            }
+            prev = rank;
+        }
+    }
+    if (counter > 0) {
+        merges += 1 + counter;
+    }
+
+    float monotonicity_left = 0;
+    float monotonicity_right = 0;
+    for (int i = 1; i < 4; ++i) {
+        if (line[i-1] > line[i]) {
+            monotonicity_left += pow(line[i-1], weights.monotonicity_power) - pow(line[i], weights.monotonicity_power);
+        } else {
+            monotonicity_right += pow(line[i], weights.monotonicity_power) - pow(line[i-1], weights.monotonicity_power);
+        }
+    }
+
+    return weights.lost_penalty +
+        weights.empty_weight * empty +
+        weights.merges_weight * merges -
+        weights.monotonicity_weight * std::min(monotonicity_left, monotonicity_right) -
+        weights.sum_weight * sum;
+}
+
+// the row after a move to the left
+static inline row_t row_move_left(unsigned row) {
+    unsigned line[4];
+    unpack_row(row, line);
+
+    for (int i = 0; i < 3; ++i) {
+        int j;
+        for (j = i + 1; j < 4; ++j) {
+            if (line[j] != 0) break;
+        }
+        if (j == 4) break; // no more tiles to the right
+
+        if (line[i] == 0) {
+            line[i] = line[j];
+            line[j] = 0;
+            i--; // retry this entry
+        } else if (line[i] == line[j]) {
+            if(line[i] != 0xf) {
+                /* Pretend that 32768 + 32768 = 32768 (representational limit). */
+                line[i]++;
+            }
+            line[j] = 0;
+        }
+    }
+
+    return (line[0] <<  0) |
+           (line[1] <<  4) |
+           (line[2] <<  8) |
+           (line[3] << 12);
+}
+
+// upper bound on the heuristic score of any board, given the largest row score: a board's
+// heuristic sums 4 rows and 4 columns, and the margin covers rounding in the float sums
+static inline float heur_score_bound(float row_heur_max) {
+    return std::max(0.0f, 8 * row_heur_max * 1.00001f);
+}
+
+#endif /* TABLES_H */
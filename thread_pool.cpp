@@ -0,0 +1,112 @@
+#include "thread_pool.h"
+
+/* Index of the pool worker running on this thread, or -1 for threads outside the pool. */
+static thread_local int worker_index = -1;
+
+thread_pool &thread_pool::instance() {
+    static thread_pool pool;
+    return pool;
+}
+
+thread_pool::thread_pool() : nworkers(0), queued(0), stopping(false) {
+}
+
+thread_pool::~thread_pool() {
+    {
+        std::lock_guard<std::mutex> guard(sleep_lock);
+        stopping = true;
+    }
+    wakeup.notify_all();
+    for (size_t i = 0; i < workers.size(); ++i)
+        workers[i].join();
+}
+
+void thread_pool::reserve(int nthreads) {
+    std::lock_guard<std::mutex> guard(workers_lock);
+    int wanted = std::min(nthreads - 1, MAX_WORKERS);
+    while ((int)workers.size() < wanted) {
+        workers.push_back(std::thread(&thread_pool::worker_main, this, (int)workers.size()));
+        nworkers++;
+    }
+}
+
+void thread_pool::spawn(task_group &group, task_func_t func, void *arg) {
+    task t = {func, arg, &group};
+    group.pending++;
+    if (nworkers == 0) {
+        // nobody to hand the task to
+        run(t);
+        return;
+    }
+
+    task_queue &q = queues[worker_index + 1];
+    {
+        std::lock_guard<std::mutex> guard(q.lock);
+        q.tasks.push_back(t);
+    }
+    queued++;
+    std::lock_guard<std::mutex> guard(sleep_lock);
+    wakeup.notify_one();
+}
+
+void thread_pool::wait(task_group &group) {
+    while (group.pending > 0) {
+        task t;
+        if (pop_local(worker_index, t) || steal(worker_index, t))
+            run(t);
+        else
+            std::this_thread::yield();
+    }
+}
+
+bool thread_pool::pop_local(int index, task &out) {
+    if (index < 0)
+        return false;
+    task_queue &q = queues[index + 1];
+    std::lock_guard<std::mutex> guard(q.lock);
+    if (q.tasks.empty())
+        return false;
+    out = q.tasks.back();
+    q.tasks.pop_back();
+    queued--;
+    return true;
+}
+
+bool thread_pool::steal(int thief, task &out) {
+    int n = nworkers + 1;
+    for (int i = 0; i < n; ++i) {
+        // start right after the thief so that thieves spread over the victims
+        int victim = (thief + 1 + i) % n;
+        task_queue &q = queues[victim];
+        std::unique_lock<std::mutex> guard(q.lock, std::try_to_lock);
+        if (!guard.owns_lock() || q.tasks.empty())
+            continue;
+        out = q.tasks.front();
+        q.tasks.pop_front();
+        queued--;
+        return true;
+    }
+    return false;
+}
+
+void thread_pool::run(const task &t) {
+    t.func(t.arg);
+    t.group->pending--;
+}
+
+void thread_pool::worker_main(int index) {
+    worker_index = index;
+    while (true) {
+        task t;
+        if (pop_local(index, t) || steal(index, t)) {
+            run(t);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> guard(sleep_lock);
+        if (stopping)
+            return;
+        if (queued == 0)
+            wakeup.wait(guard);
+    }
+}
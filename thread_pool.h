@@ -0,0 +1,84 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* Fork-join thread pool with work stealing.
+ *
+ * Each worker owns a deque: it pushes and pops its own tasks at the back (so it keeps
+ * working depth-first on the subtree it just split), while idle workers steal from the
+ * front of other deques, where the largest pieces of work sit. Threads outside the pool
+ * push into a shared injection queue.
+ *
+ * A thread waiting on a task group does not block; it keeps running queued tasks until
+ * the group finishes, so nested spawns can never deadlock the pool.
+ */
+
+typedef void (*task_func_t)(void *arg);
+
+struct task_group {
+    std::atomic<int> pending;
+
+    task_group() : pending(0) {
+    }
+};
+
+class thread_pool {
+public:
+    /* The process-wide pool, sized for the largest thread count requested so far. */
+    static thread_pool &instance();
+
+    ~thread_pool();
+
+    /* Make sure `nthreads` threads can work on a search: the caller plus nthreads - 1 workers. */
+    void reserve(int nthreads);
+
+    /* Queue func(arg) as part of `group`. */
+    void spawn(task_group &group, task_func_t func, void *arg);
+
+    /* Run queued tasks until every task of `group` has finished. */
+    void wait(task_group &group);
+
+private:
+    struct task {
+        task_func_t func;
+        void *arg;
+        task_group *group;
+    };
+
+    struct task_queue {
+        std::mutex lock;
+        std::deque<task> tasks;
+    };
+
+    static const int MAX_WORKERS = 256;
+
+    thread_pool();
+
+    void worker_main(int index);
+    bool pop_local(int index, task &out);
+    bool steal(int thief, task &out);
+    void run(const task &t);
+
+    /* queues[0] is the injection queue; worker i owns queues[i + 1]. */
+    task_queue queues[MAX_WORKERS + 1];
+    std::vector<std::thread> workers;
+    std::mutex workers_lock;
+    std::atomic<int> nworkers;
+
+    std::atomic<int> queued;
+    std::mutex sleep_lock;
+    std::condition_variable wakeup;
+    bool stopping;
+
+    thread_pool(const thread_pool &);
+    thread_pool &operator=(const thread_pool &);
+};
+
+#endif /* THREAD_POOL_H */
@@ -0,0 +1,146 @@
+/* TD(0) training of an n-tuple network on afterstates (Szubert & Jaskowski, "Temporal
+ * Difference Learning of N-Tuple Networks for the Game 2048").
+ *
+ * The games are ordinary seeded games (play_game_seeded) whose moves are chosen greedily
+ * by the network being trained: the move maximizing reward + value(afterstate), where the
+ * reward is the score the move makes. After each move, the value of the previous
+ * afterstate is moved towards this move's reward plus the value of the new afterstate; the
+ * last afterstate of a game is moved towards 0.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+
+#include "2048.h"
+#include "ntuple.h"
+#include "tables.h"
+#include "train_ntuple.h"
+
+struct td_state {
+    ntuple_network *net;
+    float alpha; // learning rate
+    board_t prev_afterstate;
+    bool has_prev;
+};
+
+static float board_score(board_t board) {
+    return row_score((board >>  0) & ROW_MASK) +
+           row_score((board >> 16) & ROW_MASK) +
+           row_score((board >> 32) & ROW_MASK) +
+           row_score((board >> 48) & ROW_MASK);
+}
+
+static int td_get_move(board_t board, void *user) {
+    td_state *td = (td_state *)user;
+
+    int best_move = -1;
+    float best_value = 0;
+    board_t best_afterstate = 0;
+    float score = board_score(board);
+    for (int move = 0; move < 4; move++) {
+        board_t afterstate = execute_move(move, board);
+        if (afterstate == board)
+            continue;
+        float reward = board_score(afterstate) - score;
+        float value = reward + td->net->value(afterstate);
+        if (best_move < 0 || value > best_value) {
+            best_move = move;
+            best_value = value;
+            best_afterstate = afterstate;
+        }
+    }
+
+    // the target for the previous afterstate: this move's reward plus the value of where it leads
+    if (td->has_prev)
+        td->net->update(td->prev_afterstate, td->alpha * (best_value - td->net->value(td->prev_afterstate)));
+    td->prev_afterstate = best_afterstate;
+    td->has_prev = true;
+    return best_move;
+}
+
+static void train_usage(const char *argv0) {
+    fprintf(stderr,
+        "Usage: %s train-ntuple -o out_file [-i in_file] [-t layout] [-n games] [-s first_seed] [-a alpha] [-r report_every]\n"
+        "  -o out_file       where to write the network; rewritten at every report\n"
+        "  -i in_file        network to continue training (default: start from zero)\n"
+        "  -t layout         tuples of a new network: 4 (1.25 MB) or 6 (256 MB) (default 4)\n"
+        "  -n games          games to train on (default 100000)\n"
+        "  -s first_seed     seed of the first game; game i uses first_seed + i (default 1)\n"
+        "  -a alpha          learning rate (default 0.1)\n"
+        "  -r report_every   games between progress lines and checkpoints (default 1000)\n",
+        argv0);
+    exit(1);
+}
+
+int train_ntuple_main(int argc, char **argv) {
+    const char *out_fn = NULL;
+    const char *in_fn = NULL;
+    const char *layout = "4";
+    int games = 100000;
+    uint64_t first_seed = 1;
+    float alpha = 0.1f;
+    int report_every = 1000;
+
+    for (int i = 2; i < argc; i++) {
+        if (i + 1 >= argc || argv[i][0] != '-' || strlen(argv[i]) != 2)
+            train_usage(argv[0]);
+        const char *arg = argv[++i];
+        switch (argv[i - 1][1]) {
+        case 'o': out_fn = arg; break;
+        case 'i': in_fn = arg; break;
+        case 't': layout = arg; break;
+        case 'n': games = atoi(arg); break;
+        case 's': first_seed = strtoull(arg, NULL, 0); break;
+        case 'a': alpha = atof(arg); break;
+        case 'r': report_every = atoi(arg); break;
+        default: train_usage(argv[0]);
+        }
+    }
+    if (!out_fn || games <= 0 || report_every <= 0 || alpha <= 0)
+        train_usage(argv[0]);
+
+    ntuple_network *net = in_fn ? ntuple_network::load_writable(in_fn) : ntuple_network::create(layout);
+    if (!net) {
+        if (!in_fn)
+            fprintf(stderr, "unknown layout %s\n", layout);
+        return 1;
+    }
+
+    td_state td;
+    td.net = net;
+    td.alpha = alpha;
+
+    double window_score = 0;
+    int window_games = 0, window_2048 = 0, window_max_rank = 0;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int i = 0; i < games; i++) {
+        game_result_t result;
+        td.has_prev = false;
+        play_game_seeded(first_seed + i, td_get_move, &td, 0, &result);
+        // nothing follows the last afterstate: its value is what the game made after it, 0
+        if (td.has_prev)
+            net->update(td.prev_afterstate, -alpha * net->value(td.prev_afterstate));
+
+        window_score += result.score;
+        window_games++;
+        window_2048 += result.maxrank >= 11;
+        window_max_rank = std::max(window_max_rank, result.maxrank);
+        if (window_games == report_every || i == games - 1) {
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            if (!net->save(out_fn))
+                return 1;
+            printf("{\"games\": %d, \"mean_score\": %.1f, \"rate_2048\": %.3f, \"max_tile\": %d, \"elapsed_sec\": %.1f, \"games_per_sec\": %.1f}\n",
+                i + 1, window_score / window_games, (double)window_2048 / window_games, 1 << window_max_rank,
+                elapsed.count(), (i + 1) / elapsed.count());
+            fflush(stdout);
+            window_score = 0;
+            window_games = window_2048 = window_max_rank = 0;
+        }
+    }
+
+    delete net;
+    return 0;
+}
@@ -0,0 +1,8 @@
+#ifndef TRAIN_NTUPLE_H
+#define TRAIN_NTUPLE_H
+
+/* `bin/2048 train-ntuple ...`: train an n-tuple network (see ntuple.h) by TD learning over
+ * seeded self-play games, printing one JSON progress line per report interval. */
+int train_ntuple_main(int argc, char **argv);
+
+#endif /* TRAIN_NTUPLE_H */
@@ -0,0 +1,218 @@
+#ifndef TRANS_TABLE_H
+#define TRANS_TABLE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+
+#include "2048.h"
+#include "huge_pages.h"
+
+/* Transposition table.
+ *
+ * The table is a preallocated power-of-two array of 64-byte buckets; a board may live in
+ * any slot of the bucket selected by its hash, and nothing is ever chained or allocated
+ * per node.
+ *
+ * Boards are hashed with the splitmix64 finalizer, which is a bijection on 64-bit words.
+ * The low (at least 16) bits of the hash pick the bucket, so a slot only has to keep the
+ * upper 48 bits of the hash to identify its board exactly. Those share a tag word with
+ * the remaining search depth and the generation of the stored result, and the heuristic
+ * lives in a parallel float array: an entry costs 12 bytes, and five of them fill one
+ * cache line.
+ *
+ * Tag layout:
+ *   bits  0..47: hash >> 16
+ *   bits 48..54: remaining depth (always >= 1, so a zero tag marks an empty slot)
+ *   bit  55:     set if the value is only an upper bound on the result (see SEARCH_OPT_PRUNE)
+ *   bits 56..63: generation
+ *
+ * A table is meant to outlive a single search. Every search starts a new generation;
+ * entries from older generations stay usable but are the first to be evicted.
+ *
+ * The table is lock-free: all threads of a search share it. Both words of a slot are
+ * relaxed atomics, and the tag is stored xor'ed with the bits of its heuristic, so a
+ * slot torn by concurrent writers fails the hash check instead of pairing a board with
+ * another board's value. A lost or rejected entry only costs a re-search.
+ */
+
+static inline uint64_t trans_table_hash(board_t board) {
+    uint64_t z = board;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+class trans_table_t {
+public:
+    static const int BUCKET_ENTRIES = 5;
+    static const int MIN_BUCKET_BITS = 16;
+
+    /* The table uses the largest power-of-two number of buckets that fits in max_bytes (minimum 4 MB). */
+    explicit trans_table_t(size_t max_bytes) : buckets(NULL), mask(0), count(0), generation(0), huge_pages(false) {
+        size_t nbuckets = size_t(1) << MIN_BUCKET_BITS;
+        while (nbuckets * 2 * sizeof(bucket_t) <= max_bytes)
+            nbuckets *= 2;
+        allocate(nbuckets);
+    }
+
+    /* Drop every entry. */
+    void clear() {
+        allocate(mask + 1);
+        generation = 0;
+    }
+
+    /* Move the table to huge pages, or back out of them (see huge_pages.h); drops every entry. */
+    void set_huge_pages(bool huge) {
+        huge_pages = huge;
+        clear();
+    }
+
+    /* HUGE_PAGES_*: what the table got. */
+    int pages() const {
+        return memory.pages;
+    }
+
+    size_t huge_bytes() const {
+        return memory.huge_bytes();
+    }
+
+    /* Start a new search: entries stored from now on are preferred over everything already in the table. */
+    void new_generation() {
+        generation = (generation + 1) & 0xff;
+    }
+
+    /* Look up a board; succeeds only if the stored result was searched at least `depth` deep.
+     * An entry stored as an upper bound is only returned to callers that take bounds, with
+     * *upper_bound set; for everyone else it is a miss. */
+    bool lookup(board_t board, int depth, float &heuristic, bool *upper_bound = NULL) {
+        uint64_t hash = trans_table_hash(board);
+        bucket_t &bucket = buckets[hash & mask];
+        uint64_t check = hash >> 16;
+        for (int i = 0; i < BUCKET_ENTRIES; ++i) {
+            uint32_t value = bucket.heuristics[i].load(std::memory_order_relaxed);
+            uint64_t tag = bucket.tags[i].load(std::memory_order_relaxed) ^ value;
+            if ((tag & CHECK_MASK) == check && tag != 0) {
+                if (tag_depth(tag) < depth)
+                    return false;
+                bool bound = tag_is_bound(tag);
+                if (bound && !upper_bound)
+                    return false;
+                if (tag_generation(tag) != generation)
+                    bucket.tags[i].store(make_tag(check, tag_depth(tag), bound) ^ value, std::memory_order_relaxed);
+                memcpy(&heuristic, &value, sizeof(heuristic));
+                if (upper_bound)
+                    *upper_bound = bound;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /* What store() did with an entry. */
+    enum store_result {
+        STORE_FILLED, // took an empty slot
+        STORE_UPDATED, // replaced an older entry for the same board
+        STORE_EVICTED, // replaced the entry of another board
+        STORE_REJECTED, // kept a deeper exact entry for the same board instead of a bound
+    };
+
+    /* Store a result, or an upper bound on it. When the bucket is full, stale entries are
+     * replaced before current ones, and the shallowest search is replaced first. A bound never
+     * replaces an exact result for the same board that is at least as deep. */
+    store_result store(board_t board, int depth, float heuristic, bool upper_bound = false) {
+        uint64_t hash = trans_table_hash(board);
+        bucket_t &bucket = buckets[hash & mask];
+        uint64_t check = hash >> 16;
+        int victim = 0;
+        int victim_priority = 0x7fffffff;
+        store_result result = STORE_EVICTED;
+        for (int i = 0; i < BUCKET_ENTRIES; ++i) {
+            uint64_t tag = bucket.tags[i].load(std::memory_order_relaxed) ^ bucket.heuristics[i].load(std::memory_order_relaxed);
+            if (tag == 0) {
+                victim = i;
+                result = STORE_FILLED;
+                count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                break;
+            }
+            if ((tag & CHECK_MASK) == check) {
+                if (upper_bound && !tag_is_bound(tag) && tag_depth(tag) >= depth)
+                    return STORE_REJECTED;
+                victim = i;
+                result = STORE_UPDATED;
+                break;
+            }
+            int priority = tag_depth(tag) + ((tag_generation(tag) == generation) ? 0x100 : 0);
+            if (priority < victim_priority) {
+                victim = i;
+                victim_priority = priority;
+            }
+        }
+        uint32_t value;
+        memcpy(&value, &heuristic, sizeof(value));
+        bucket.heuristics[victim].store(value, std::memory_order_relaxed);
+        bucket.tags[victim].store(make_tag(check, depth, upper_bound) ^ value, std::memory_order_relaxed);
+        return result;
+    }
+
+    /* Number of slots that have ever been filled. */
+    size_t size() const {
+        return count;
+    }
+
+    size_t capacity() const {
+        return (mask + 1) * BUCKET_ENTRIES;
+    }
+
+private:
+    static const uint64_t CHECK_MASK = 0x0000FFFFFFFFFFFFULL;
+    static const int BOUND_FLAG = 0x80; // in the depth byte
+
+    struct bucket_t {
+        std::atomic<uint64_t> tags[BUCKET_ENTRIES];
+        std::atomic<uint32_t> heuristics[BUCKET_ENTRIES]; // bits of the float heuristic
+        uint32_t pad;
+    };
+
+    static inline int tag_depth(uint64_t tag) {
+        return (tag >> 48) & 0x7f;
+    }
+
+    static inline bool tag_is_bound(uint64_t tag) {
+        return (tag >> 48) & BOUND_FLAG;
+    }
+
+    static inline unsigned tag_generation(uint64_t tag) {
+        return (tag >> 56) & 0xff;
+    }
+
+    inline uint64_t make_tag(uint64_t check, int depth, bool bound) const {
+        return check | (uint64_t((depth & 0x7f) | (bound ? BOUND_FLAG : 0)) << 48) | (uint64_t(generation) << 56);
+    }
+
+    void allocate(size_t nbuckets) {
+        /* The buffer is zeroed (= empty buckets) and aligned to cache lines, and for large
+         * tables the OS only backs the pages once they are touched. */
+        if (!memory.allocate(nbuckets * sizeof(bucket_t), huge_pages)) {
+            fprintf(stderr, "Unable to allocate %lu-byte transposition table\n", (unsigned long)(nbuckets * sizeof(bucket_t)));
+            abort();
+        }
+        buckets = (bucket_t *)memory.data;
+        mask = nbuckets - 1;
+        count = 0;
+    }
+
+    huge_buffer memory;
+    bucket_t *buckets;
+    size_t mask;
+    std::atomic<size_t> count; // racy on purpose: it only reports how full the table is
+    std::atomic<unsigned> generation;
+    bool huge_pages; // allocate the buckets in huge pages
+
+    trans_table_t(const trans_table_t &);
+    trans_table_t &operator=(const trans_table_t &);
+};
+
+#endif /* TRANS_TABLE_H */